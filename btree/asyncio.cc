@@ -0,0 +1,308 @@
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#ifdef __NR_io_uring_setup
+#include <linux/io_uring.h>
+#endif
+
+#include "asyncio.h"
+
+// Threads the fallback runs at most, however deep the queue
+const SIZE_T MAX_IO_THREADS = 32;
+
+
+IOEngine *IOEngine::Create(const int fd, const SIZE_T queuedepth, const bool threads) {
+    if (queuedepth < 1) {
+        return 0;
+    }
+    if (!threads) {
+        UringEngine *e = new UringEngine(fd, queuedepth);
+        if (e->IsReady()) {
+            return e;
+        }
+        delete e;
+    }
+    ThreadPoolEngine *e = new ThreadPoolEngine(fd, queuedepth);
+    if (e->IsReady()) {
+        return e;
+    }
+    delete e;
+    return 0;
+}
+
+SIZE_T IOEngine::Poll(vector<IOCompletion> &done) {
+    SIZE_T n = done.size();
+    Wait(done, 0);
+    return done.size() - n;
+}
+
+
+#ifdef __NR_io_uring_setup
+
+static int io_uring_setup(const unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(const int ringfd, const unsigned tosubmit, const unsigned mincomplete,
+                          const unsigned flags) {
+    return (int) syscall(__NR_io_uring_enter, ringfd, tosubmit, mincomplete, flags, 0, 0);
+}
+
+UringEngine::UringEngine(const int fd, const SIZE_T queuedepth) :
+        IOEngine(fd, queuedepth), ringfd(-1), sqring(MAP_FAILED), cqring(MAP_FAILED), sqringbytes(0),
+        cqringbytes(0), sqes((io_uring_sqe *) MAP_FAILED), sqesbytes(0), unsubmitted(0) {
+    struct io_uring_params p;
+
+    memset(&p, 0, sizeof(p));
+    if ((ringfd = io_uring_setup(queuedepth, &p)) < 0) {
+        // ENOSYS, or a sandbox that forbids it
+        ringfd = -1;
+        return;
+    }
+    sqringbytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqringbytes = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        sqringbytes = cqringbytes = sqringbytes > cqringbytes ? sqringbytes : cqringbytes;
+    }
+    sqring = mmap(0, sqringbytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd, IORING_OFF_SQ_RING);
+    if (sqring == MAP_FAILED) {
+        close(ringfd);
+        ringfd = -1;
+        return;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        cqring = sqring;
+    } else {
+        cqring = mmap(0, cqringbytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd,
+                      IORING_OFF_CQ_RING);
+    }
+    sqesbytes = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *) mmap(0, sqesbytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringfd,
+                                 IORING_OFF_SQES);
+    if (cqring == MAP_FAILED || sqes == MAP_FAILED) {
+        Teardown();
+        return;
+    }
+
+    BYTE_T *sq = (BYTE_T *) sqring, *cq = (BYTE_T *) cqring;
+    sqtail = (unsigned *) (sq + p.sq_off.tail);
+    sqmask = (unsigned *) (sq + p.sq_off.ring_mask);
+    sqarray = (unsigned *) (sq + p.sq_off.array);
+    cqhead = (unsigned *) (cq + p.cq_off.head);
+    cqtail = (unsigned *) (cq + p.cq_off.tail);
+    cqmask = (unsigned *) (cq + p.cq_off.ring_mask);
+    cqes = (io_uring_cqe *) (cq + p.cq_off.cqes);
+
+    slots.resize(queuedepth);
+    for (SIZE_T i = queuedepth; i > 0; i--) {
+        freeslots.push_back(i - 1);
+    }
+}
+
+UringEngine::~UringEngine() {
+    if (ringfd >= 0 && inflight > 0) {
+        vector<IOCompletion> done;
+        Wait(done, inflight);
+    }
+    Teardown();
+}
+
+void UringEngine::Teardown() {
+    if (sqes != MAP_FAILED) {
+        munmap(sqes, sqesbytes);
+        sqes = (io_uring_sqe *) MAP_FAILED;
+    }
+    if (cqring != MAP_FAILED && cqring != sqring) {
+        munmap(cqring, cqringbytes);
+    }
+    cqring = MAP_FAILED;
+    if (sqring != MAP_FAILED) {
+        munmap(sqring, sqringbytes);
+        sqring = MAP_FAILED;
+    }
+    if (ringfd >= 0) {
+        close(ringfd);
+        ringfd = -1;
+    }
+}
+
+ERROR_T UringEngine::Submit(const bool write, const off_t pos, BYTE_T *buf, const size_t len,
+                            const unsigned long long tag) {
+    if (inflight >= queuedepth) {
+        return ERROR_NOSPACE;
+    }
+    SIZE_T slot = freeslots.back();
+    freeslots.pop_back();
+    slots[slot].tag = tag;
+    slots[slot].len = len;
+
+    // Only we move the tail, so it needs no atomic load
+    unsigned tail = *sqtail;
+    unsigned i = tail & *sqmask;
+    io_uring_sqe *sqe = &sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+    sqe->fd = fd;
+    sqe->off = pos;
+    sqe->addr = (unsigned long) buf;
+    sqe->len = len;
+    sqe->user_data = slot;
+    sqarray[i] = i;
+    __atomic_store_n(sqtail, tail + 1, __ATOMIC_RELEASE);
+
+    unsubmitted++;
+    inflight++;
+    return ERROR_NOERROR;
+}
+
+void UringEngine::Reap(vector<IOCompletion> &done, SIZE_T &got) {
+    unsigned head = *cqhead;
+    unsigned tail = __atomic_load_n(cqtail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++) {
+        io_uring_cqe *cqe = &cqes[head & *cqmask];
+        Slot &s = slots[cqe->user_data];
+        IOCompletion c;
+        c.tag = s.tag;
+        c.rc = cqe->res == (int) s.len ? ERROR_NOERROR : ERROR_IMPLBUG;
+        done.push_back(c);
+        freeslots.push_back(cqe->user_data);
+        inflight--;
+        got++;
+    }
+    __atomic_store_n(cqhead, head, __ATOMIC_RELEASE);
+}
+
+ERROR_T UringEngine::Wait(vector<IOCompletion> &done, const SIZE_T min) {
+    SIZE_T want = min < inflight ? min : inflight;
+    SIZE_T got = 0;
+
+    Reap(done, got);
+    while (unsubmitted > 0 || got < want) {
+        unsigned flags = got < want ? IORING_ENTER_GETEVENTS : 0;
+        int n = io_uring_enter(ringfd, unsubmitted, got < want ? want - got : 0, flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return ERROR_GENERAL;
+        }
+        unsubmitted -= n;
+        Reap(done, got);
+    }
+    return ERROR_NOERROR;
+}
+
+#else
+
+// No io_uring in these headers, so Create always falls back to threads
+
+UringEngine::UringEngine(const int fd, const SIZE_T queuedepth) : IOEngine(fd, queuedepth), ringfd(-1) { }
+
+UringEngine::~UringEngine() { }
+
+ERROR_T UringEngine::Submit(const bool write, const off_t pos, BYTE_T *buf, const size_t len,
+                            const unsigned long long tag) {
+    return ERROR_UNIMPL;
+}
+
+void UringEngine::Reap(vector<IOCompletion> &done, SIZE_T &got) { }
+
+void UringEngine::Teardown() { }
+
+ERROR_T UringEngine::Wait(vector<IOCompletion> &done, const SIZE_T min) {
+    return ERROR_UNIMPL;
+}
+
+#endif
+
+
+ThreadPoolEngine::ThreadPoolEngine(const int fd, const SIZE_T queuedepth) : IOEngine(fd, queuedepth), stop(false) {
+    pthread_mutex_init(&lock, 0);
+    pthread_cond_init(&work, 0);
+    pthread_cond_init(&finished, 0);
+    SIZE_T n = queuedepth < MAX_IO_THREADS ? queuedepth : MAX_IO_THREADS;
+    for (SIZE_T i = 0; i < n; i++) {
+        pthread_t t;
+        if (pthread_create(&t, 0, WorkerThread, this) != 0) {
+            break;
+        }
+        threads.push_back(t);
+    }
+}
+
+ThreadPoolEngine::~ThreadPoolEngine() {
+    pthread_mutex_lock(&lock);
+    // The queue drains before the workers see stop
+    stop = true;
+    pthread_cond_broadcast(&work);
+    pthread_mutex_unlock(&lock);
+    for (SIZE_T i = 0; i < threads.size(); i++) {
+        pthread_join(threads[i], 0);
+    }
+    pthread_cond_destroy(&finished);
+    pthread_cond_destroy(&work);
+    pthread_mutex_destroy(&lock);
+}
+
+void *ThreadPoolEngine::WorkerThread(void *arg) {
+    ((ThreadPoolEngine *) arg)->WorkerLoop();
+    return 0;
+}
+
+void ThreadPoolEngine::WorkerLoop() {
+    pthread_mutex_lock(&lock);
+    while (true) {
+        while (requests.empty() && !stop) {
+            pthread_cond_wait(&work, &lock);
+        }
+        if (requests.empty()) {
+            break;
+        }
+        Request r = requests.front();
+        requests.pop_front();
+        pthread_mutex_unlock(&lock);
+
+        ssize_t n = r.write ? pwrite(fd, r.buf, r.len, r.pos) : pread(fd, r.buf, r.len, r.pos);
+        IOCompletion c;
+        c.tag = r.tag;
+        c.rc = n == (ssize_t) r.len ? ERROR_NOERROR : ERROR_IMPLBUG;
+
+        pthread_mutex_lock(&lock);
+        completions.push_back(c);
+        pthread_cond_signal(&finished);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+ERROR_T ThreadPoolEngine::Submit(const bool write, const off_t pos, BYTE_T *buf, const size_t len,
+                                 const unsigned long long tag) {
+    if (inflight >= queuedepth) {
+        return ERROR_NOSPACE;
+    }
+    Request r = { write, pos, buf, len, tag };
+
+    pthread_mutex_lock(&lock);
+    requests.push_back(r);
+    pthread_cond_signal(&work);
+    pthread_mutex_unlock(&lock);
+    inflight++;
+    return ERROR_NOERROR;
+}
+
+ERROR_T ThreadPoolEngine::Wait(vector<IOCompletion> &done, const SIZE_T min) {
+    SIZE_T want = min < inflight ? min : inflight;
+
+    pthread_mutex_lock(&lock);
+    while (completions.size() < want) {
+        pthread_cond_wait(&finished, &lock);
+    }
+    done.insert(done.end(), completions.begin(), completions.end());
+    inflight -= completions.size();
+    completions.clear();
+    pthread_mutex_unlock(&lock);
+    return ERROR_NOERROR;
+}
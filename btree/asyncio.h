@@ -0,0 +1,163 @@
+#ifndef _asyncio
+#define _asyncio
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "global.h"
+
+using namespace std;
+
+struct IOCompletion {
+    unsigned long long tag;     // as given when submitted
+    ERROR_T rc;
+};
+
+
+//
+// Keeps several reads and writes on a file in flight at once
+//
+// At most the queue depth can be outstanding; a submission beyond that
+// returns ERROR_NOSPACE until a completion has been collected.  The
+// buffer has to stay put until then.  Completions come back in whatever
+// order the requests finish.
+//
+class IOEngine {
+protected:
+    int fd;
+    SIZE_T queuedepth;
+    SIZE_T inflight;            // submitted and not yet collected
+
+    virtual ERROR_T Submit(const bool write, const off_t pos, BYTE_T *buf, const size_t len,
+                           const unsigned long long tag) = 0;
+
+public:
+    IOEngine(const int fd, const SIZE_T queuedepth) : fd(fd), queuedepth(queuedepth), inflight(0) { }
+
+    // Waits for whatever is still in flight
+    virtual ~IOEngine() { }
+
+    // io_uring unless threads is set or the kernel won't set up a ring,
+    // a pool of threads otherwise.  Returns null if neither works.
+    static IOEngine *Create(const int fd, const SIZE_T queuedepth, const bool threads = false);
+
+    ERROR_T SubmitRead(const off_t pos, BYTE_T *buf, const size_t len, const unsigned long long tag) {
+        return Submit(false, pos, buf, len, tag);
+    }
+
+    ERROR_T SubmitWrite(const off_t pos, const BYTE_T *buf, const size_t len, const unsigned long long tag) {
+        return Submit(true, pos, (BYTE_T *) buf, len, tag);
+    }
+
+    // Appends finished requests to done, blocking until at least min
+    // (or everything in flight, if less) have finished
+    virtual ERROR_T Wait(vector<IOCompletion> &done, const SIZE_T min = 1) = 0;
+
+    // Wait without blocking; returns how many were appended
+    SIZE_T Poll(vector<IOCompletion> &done);
+
+    SIZE_T GetNumInFlight() const { return inflight; }
+
+    SIZE_T GetQueueDepth() const { return queuedepth; }
+
+    virtual const char *GetName() const = 0;
+};
+
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+//
+// io_uring through the raw system calls.  Submissions collect in the
+// ring and reach the kernel together at the next Wait or Poll.
+//
+class UringEngine : public IOEngine {
+private:
+    struct Slot {
+        unsigned long long tag;
+        size_t len;
+    };
+
+    int ringfd;
+    void *sqring;
+    void *cqring;               // the same as sqring if the kernel maps them together
+    size_t sqringbytes;
+    size_t cqringbytes;
+    io_uring_sqe *sqes;
+    size_t sqesbytes;
+    unsigned *sqtail, *sqmask, *sqarray;
+    unsigned *cqhead, *cqtail, *cqmask;
+    io_uring_cqe *cqes;
+    SIZE_T unsubmitted;         // in the ring, not yet handed to the kernel
+    vector <Slot> slots;        // by user_data, for the length each should move
+    vector <SIZE_T> freeslots;
+
+    void Reap(vector<IOCompletion> &done, SIZE_T &got);
+
+    // Unmaps and closes whatever the constructor got
+    void Teardown();
+
+protected:
+    ERROR_T Submit(const bool write, const off_t pos, BYTE_T *buf, const size_t len,
+                   const unsigned long long tag);
+
+public:
+    UringEngine(const int fd, const SIZE_T queuedepth);
+
+    ~UringEngine();
+
+    // Whether the constructor got a ring from the kernel
+    bool IsReady() const { return ringfd >= 0; }
+
+    ERROR_T Wait(vector<IOCompletion> &done, const SIZE_T min = 1);
+
+    const char *GetName() const { return "io_uring"; }
+};
+
+
+//
+// pread/pwrite on a pool of threads, one per request the queue can hold
+// up to a limit
+//
+class ThreadPoolEngine : public IOEngine {
+private:
+    struct Request {
+        bool write;
+        off_t pos;
+        BYTE_T *buf;
+        size_t len;
+        unsigned long long tag;
+    };
+
+    vector <pthread_t> threads;
+    deque <Request> requests;
+    vector <IOCompletion> completions;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // a request was queued, or stop was set
+    pthread_cond_t finished;    // a completion was added
+    bool stop;
+
+    static void *WorkerThread(void *arg);
+
+    void WorkerLoop();
+
+protected:
+    ERROR_T Submit(const bool write, const off_t pos, BYTE_T *buf, const size_t len,
+                   const unsigned long long tag);
+
+public:
+    ThreadPoolEngine(const int fd, const SIZE_T queuedepth);
+
+    ~ThreadPoolEngine();
+
+    bool IsReady() const { return !threads.empty(); }
+
+    ERROR_T Wait(vector<IOCompletion> &done, const SIZE_T min = 1);
+
+    const char *GetName() const { return "threads"; }
+};
+
+#endif
@@ -0,0 +1,31 @@
+#include <stdio.h>
+
+#include "benchutil.h"
+
+
+void make_key(char *buf, const SIZE_T i) {
+    sprintf(buf, "%08u", i);
+}
+
+ERROR_T build_tree(DiskSystem &disk, const SIZE_T cachesize, const SIZE_T numkeys) {
+    BufferCache cache(&disk, cachesize);
+    BTreeIndex btree(8, 8, &cache);
+    SIZE_T superblocknum;
+    char key[16];
+    ERROR_T rc;
+
+    if ((rc = cache.Attach()) != ERROR_NOERROR || (rc = btree.Attach(0, true)) != ERROR_NOERROR) {
+        return rc;
+    }
+    for (SIZE_T i = 0; i < numkeys; i++) {
+        make_key(key, (SIZE_T) ((i * 7919ULL) % numkeys));
+        rc = btree.Insert(KEY_T(key), VALUE_T(key));
+        if (rc != ERROR_NOERROR && rc != ERROR_CONFLICT) {
+            return rc;
+        }
+    }
+    if ((rc = btree.Detach(superblocknum)) != ERROR_NOERROR) {
+        return rc;
+    }
+    return cache.Detach();
+}
@@ -0,0 +1,20 @@
+#ifndef _benchutil
+#define _benchutil
+
+#include "btree.h"
+
+//
+// The btree the benchmarks run against
+//
+
+// The key for i, eight digits so that keys sort as their numbers do;
+// buf needs room for nine bytes
+void make_key(char *buf, const SIZE_T i);
+
+// Creates a btree of 8 byte keys and values on disk holding the keys
+// for 0 to numkeys-1, each its own value, inserted in a scattered
+// order (a permutation unless numkeys is a multiple of 7919).  Its
+// superblock is block 0.
+ERROR_T build_tree(DiskSystem &disk, const SIZE_T cachesize, const SIZE_T numkeys);
+
+#endif
@@ -46,6 +46,11 @@ Block &Block::operator=(const Block &rhs) {
 ERROR_T Block::Resize(const SIZE_T newlen, const bool copy) {
     BYTE_T *d;
 
+    if (data && newlen == length) {
+        // reuse the buffer we have
+        return ERROR_NOERROR;
+    }
+
     try {
         d = new BYTE_T[newlen];
     } catch (...) {
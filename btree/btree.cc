@@ -152,16 +152,26 @@ ERROR_T BTreeIndex::Detach(SIZE_T &initblock) {
 
 ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node, const BTreeOp op, const KEY_T &key, VALUE_T &value) {
     BTreeNode b;
+    BlockHandle h;
     ERROR_T rc;
     SIZE_T offset;
-    KEY_T testkey;
     SIZE_T ptr;
 
-    rc = b.Unserialize(buffercache, node);
+    // Search the cached block in place rather than copying it out.
+    // Interior nodes are only read on the way down, so an update holds
+    // only the leaf it changes exclusively.
+    rc = b.Pin(buffercache, node, h, false);
 
     if (rc != ERROR_NOERROR) {
         return rc;
     }
+    if (op == BTREE_OP_UPDATE && b.info.nodetype == BTREE_LEAF_NODE) {
+        b.Unpin(buffercache, h, false);
+        rc = b.Pin(buffercache, node, h, true);
+        if (rc != ERROR_NOERROR) {
+            return rc;
+        }
+    }
 
     switch (b.info.nodetype) {
         case BTREE_ROOT_NODE:
@@ -169,13 +179,12 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node, const BTreeOp op,
             // Scan through key/ptr pairs
             //and recurse if possible
             for (offset = 0; offset < b.info.numkeys; offset++) {
-                rc = b.GetKey(offset, testkey);
-                if (rc) { return rc; }
-                if (key < testkey || key == testkey) {
+                if (memcmp(key.data, b.ResolveKey(offset), b.info.keysize) <= 0) {
                     // OK, so we now have the first key that's larger
                     // so we ned to recurse on the ptr immediately previous to
                     // this one, if it exists
                     rc = b.GetPtr(offset, ptr);
+                    b.Unpin(buffercache, h, false);
                     if (rc) { return rc; }
                     return LookupOrUpdateInternal(ptr, op, key, value);
                 }
@@ -183,31 +192,36 @@ ERROR_T BTreeIndex::LookupOrUpdateInternal(const SIZE_T &node, const BTreeOp op,
             // if we got here, we need to go to the next pointer, if it exists
             if (b.info.numkeys > 0) {
                 rc = b.GetPtr(b.info.numkeys, ptr);
+                b.Unpin(buffercache, h, false);
                 if (rc) { return rc; }
                 return LookupOrUpdateInternal(ptr, op, key, value);
             } else {
                 // There are no keys at all on this node, so nowhere to go
+                b.Unpin(buffercache, h, false);
                 return ERROR_NONEXISTENT;
             }
             break;
         case BTREE_LEAF_NODE:
             // Scan through keys looking for matching value
             for (offset = 0; offset < b.info.numkeys; offset++) {
-                rc = b.GetKey(offset, testkey);
-                if (rc) { return rc; }
-                if (testkey == key) {
+                if (memcmp(key.data, b.ResolveKey(offset), b.info.keysize) == 0) {
                     if (op == BTREE_OP_LOOKUP) {
-                        return b.GetVal(offset, value);
+                        rc = b.GetVal(offset, value);
+                        b.Unpin(buffercache, h, false);
+                        return rc;
                     } else {
-                        if ((rc = b.SetVal(offset, value))) return rc;
-                        return b.Serialize(buffercache, node);
+                        rc = b.SetVal(offset, value);
+                        b.Unpin(buffercache, h, rc == ERROR_NOERROR);
+                        return rc;
                     }
                 }
             }
+            b.Unpin(buffercache, h, false);
             return ERROR_NONEXISTENT;
             break;
         default:
             // We can't be looking at anything other than a root, internal, or leaf
+            b.Unpin(buffercache, h, false);
             return ERROR_INSANE;
             break;
     }
@@ -529,7 +543,8 @@ ERROR_T BTreeIndex::DisplayInternal(const SIZE_T &node, ostream &o, BTreeDisplay
     ERROR_T rc;
     SIZE_T offset;
 
-    rc = b.Unserialize(buffercache, node);
+    // Every node is read once, so keep them from flushing the cache
+    rc = b.Unserialize(buffercache, node, true);
 
     if (rc != ERROR_NOERROR) {
         return rc;
@@ -597,7 +612,7 @@ ERROR_T BTreeIndex::SanityCheckInternal(const SIZE_T &node, const KEY_T &key, co
     KEY_T preKey;
     KEY_T curKey;
 
-    b.Unserialize(buffercache, node);
+    b.Unserialize(buffercache, node, true);
 
     for (offset = 0; offset < b.info.numkeys; offset++) {
         if (offset == 0) {
@@ -631,7 +646,7 @@ ERROR_T BTreeIndex::SanityCheck() const {
     KEY_T preKey;
     KEY_T curKey;
 
-    b.Unserialize(buffercache, superblock.info.rootnode);
+    b.Unserialize(buffercache, superblock.info.rootnode, true);
     for (offset = 0; offset < b.info.numkeys; offset++) {
         if (offset == 0) {
             assert(b.GetKey(offset, curKey) == ERROR_NOERROR);
@@ -1,8 +1,10 @@
 #include <stdlib.h>
+#include <memory>
 #include "btree.h"
+#include "toolutil.h"
 
 void usage() {
-    cerr << "usage: btree_delete filestem cachesize key\n";
+    cerr << "usage: btree_delete filestem cachesize key [--stats-json file]\n";
 }
 
 
@@ -11,6 +13,10 @@ int main(int argc, char **argv) {
     SIZE_T cachesize;
     SIZE_T superblocknum;
     char *key;
+    char *statsjson;
+
+    // --stats-json file, if given, comes last
+    statsjson = take_stats_json(argc, argv);
 
     if (argc != 4) {
         usage();
@@ -21,8 +27,14 @@ int main(int argc, char **argv) {
     cachesize = atoi(argv[2]);
     key = argv[3];
 
-    DiskSystem disk(filestem);
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(filestem));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
     BufferCache cache(&disk, cachesize);
+    cache.SetTrackReuse(statsjson != 0);
     BTreeIndex btree(0, 0, &cache);
 
     ERROR_T rc;
@@ -63,6 +75,10 @@ int main(int argc, char **argv) {
 
         cerr << "total time      = " << cache.GetCurrentTime() << endl;
 
+        if (write_stats_json(cache, statsjson) != ERROR_NOERROR) {
+            return -1;
+        }
+
         return 0;
     }
 }
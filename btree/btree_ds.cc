@@ -10,6 +10,22 @@
 
 using namespace std;
 
+// The node types line up with the cache's block kinds
+static BlockKind block_kind(const int nodetype) {
+    switch (nodetype) {
+        case BTREE_SUPERBLOCK:
+            return BLOCK_SUPERBLOCK;
+        case BTREE_ROOT_NODE:
+            return BLOCK_ROOT;
+        case BTREE_INTERIOR_NODE:
+            return BLOCK_INTERIOR;
+        case BTREE_LEAF_NODE:
+            return BLOCK_LEAF;
+        default:
+            return BLOCK_OTHER;
+    }
+}
+
 SIZE_T NodeMetadata::GetNumDataBytes() const {
     SIZE_T n = blocksize - sizeof(*this);
     return n;
@@ -39,13 +55,15 @@ ostream &NodeMetadata::Print(ostream &os) const {
 BTreeNode::BTreeNode() {
     info.nodetype = BTREE_UNALLOCATED_BLOCK;
     data = 0;
+    borrowed = false;
 }
 
 BTreeNode::~BTreeNode() {
-    if (data) {
+    if (data && !borrowed) {
         delete[] data;
     }
     data = 0;
+    borrowed = false;
     info.nodetype = BTREE_UNALLOCATED_BLOCK;
 }
 
@@ -59,6 +77,7 @@ BTreeNode::BTreeNode(int node_type, SIZE_T key_size, SIZE_T value_size, SIZE_T b
     info.freelist = 0;
     info.numkeys = 0;
     data = 0;
+    borrowed = false;
     if (info.nodetype != BTREE_UNALLOCATED_BLOCK && info.nodetype != BTREE_SUPERBLOCK) {
         data = new char[info.GetNumDataBytes()];
         memset(data, 0, info.GetNumDataBytes());
@@ -74,6 +93,7 @@ BTreeNode::BTreeNode(const BTreeNode &rhs) {
     info.freelist = rhs.info.freelist;
     info.numkeys = rhs.info.numkeys;
     data = 0;
+    borrowed = false;
     if (rhs.data) {
         data = new char[info.GetNumDataBytes()];
         memcpy(data, rhs.data, info.GetNumDataBytes());
@@ -89,46 +109,99 @@ BTreeNode &BTreeNode::operator=(const BTreeNode &rhs) {
 ERROR_T BTreeNode::Serialize(BufferCache *b, const SIZE_T blocknum) const {
     assert((unsigned) info.blocksize == b->GetBlockSize());
 
-    Block block(sizeof(info) + info.GetNumDataBytes());
+    BlockHandle h;
+
+    ERROR_T rc;
 
-    memcpy(block.data, &info, sizeof(info));
+    // Build the block in place in the cache
+    rc = b->PinBlock(blocknum, h, PIN_OVERWRITE);
+
+    if (rc != ERROR_NOERROR) {
+        return rc;
+    }
+
+    b->NoteBlockKind(h, block_kind(info.nodetype));
+    memcpy(h.data, &info, sizeof(info));
     if (info.nodetype != BTREE_UNALLOCATED_BLOCK && info.nodetype != BTREE_SUPERBLOCK) {
-        memcpy(block.data + sizeof(info), data, info.GetNumDataBytes());
+        memcpy(h.data + sizeof(info), data, info.GetNumDataBytes());
     }
 
-    return b->WriteBlock(blocknum, block);
+    return b->UnpinBlock(h, true);
 }
 
 
-ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum) {
-    Block block;
+ERROR_T  BTreeNode::Unserialize(BufferCache *b, const SIZE_T blocknum, const bool scan) {
+    BlockHandle h;
 
     ERROR_T rc;
 
-    rc = b->ReadBlock(blocknum, block);
+    rc = b->PinBlock(blocknum, h, PIN_SHARED, scan ? ACCESS_SCAN : ACCESS_NORMAL);
 
     if (rc != ERROR_NOERROR) {
         return rc;
     }
 
-    memcpy(&info, block.data, sizeof(info));
+    memcpy(&info, h.data, sizeof(info));
+    b->NoteBlockKind(h, block_kind(info.nodetype));
 
-    if (data) {
+    if (data && !borrowed) {
         delete[] data;
-        data = 0;
     }
+    data = 0;
+    borrowed = false;
 
     assert(b->GetBlockSize() == (unsigned) info.blocksize);
 
     if (info.nodetype != BTREE_UNALLOCATED_BLOCK && info.nodetype != BTREE_SUPERBLOCK) {
         data = new char[info.GetNumDataBytes()];
-        memcpy(data, block.data + sizeof(info), info.GetNumDataBytes());
+        memcpy(data, h.data + sizeof(info), info.GetNumDataBytes());
+    }
+
+    return b->UnpinBlock(h, false);
+}
+
+
+ERROR_T BTreeNode::Pin(BufferCache *b, const SIZE_T blocknum, BlockHandle &h, const bool exclusive) {
+    ERROR_T rc;
+
+    rc = b->PinBlock(blocknum, h, exclusive ? PIN_EXCLUSIVE : PIN_SHARED);
+
+    if (rc != ERROR_NOERROR) {
+        return rc;
+    }
+
+    memcpy(&info, h.data, sizeof(info));
+    b->NoteBlockKind(h, block_kind(info.nodetype));
+
+    if (data && !borrowed) {
+        delete[] data;
+    }
+    data = 0;
+    borrowed = false;
+
+    assert(b->GetBlockSize() == (unsigned) info.blocksize);
+
+    if (info.nodetype != BTREE_UNALLOCATED_BLOCK && info.nodetype != BTREE_SUPERBLOCK) {
+        data = (char *) h.data + sizeof(info);
+        borrowed = true;
     }
 
     return ERROR_NOERROR;
 }
 
 
+ERROR_T BTreeNode::Unpin(BufferCache *b, BlockHandle &h, const bool dirty) {
+    if (dirty) {
+        memcpy(h.data, &info, sizeof(info));
+    }
+    if (borrowed) {
+        data = 0;
+        borrowed = false;
+    }
+    return b->UnpinBlock(h, dirty);
+}
+
+
 char *BTreeNode::ResolveKey(const SIZE_T offset) const {
     switch (info.nodetype) {
         case BTREE_INTERIOR_NODE:
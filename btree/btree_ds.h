@@ -23,6 +23,8 @@ typedef KeyOrValue VALUE_T;
 
 class BufferCache;
 
+struct BlockHandle;
+
 struct KeyValuePair;
 
 struct NodeMetadata {
@@ -69,6 +71,8 @@ struct BTreeNode {
     // interior => array of keys
     // leaf => array of key/value pairs
 
+    bool borrowed;  // data points into a pinned cache block
+
 
     BTreeNode();
 
@@ -87,7 +91,16 @@ struct BTreeNode {
 
     ERROR_T Serialize(BufferCache *b, const SIZE_T block) const;
 
-    ERROR_T Unserialize(BufferCache *b, const SIZE_T block);
+    // scan marks the read as part of a pass over the whole tree
+    ERROR_T Unserialize(BufferCache *b, const SIZE_T block, const bool scan = false);
+
+    // Zero-copy alternative to Unserialize: data points straight into
+    // the cached block until Unpin, so Set* calls change the cache.
+    // Pass dirty=true to Unpin if anything (including info) changed,
+    // which needs an exclusive pin.
+    ERROR_T Pin(BufferCache *b, const SIZE_T block, BlockHandle &h, const bool exclusive = false);
+
+    ERROR_T Unpin(BufferCache *b, BlockHandle &h, const bool dirty);
 
     char *ResolveKey(const SIZE_T offset) const; // Gives a pointer to the ith key  (interior or leaf)
     char *ResolvePtr(const SIZE_T offset) const; // Gives a pointer to the ith pointer (interior)
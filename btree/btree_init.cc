@@ -1,9 +1,11 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <memory>
 #include "btree.h"
+#include "toolutil.h"
 
 void usage() {
-    cerr << "usage: btree_init filestem cachesize keysize valuesize\n";
+    cerr << "usage: btree_init filestem cachesize keysize valuesize [--stats-json file]\n";
 }
 
 
@@ -11,6 +13,10 @@ int main(int argc, char **argv) {
     char *filestem;
     SIZE_T cachesize, keysize, valuesize;
     SIZE_T superblocknum;
+    char *statsjson;
+
+    // --stats-json file, if given, comes last
+    statsjson = take_stats_json(argc, argv);
 
     if (argc != 5) {
         usage();
@@ -22,8 +28,14 @@ int main(int argc, char **argv) {
     keysize = atoi(argv[3]);
     valuesize = atoi(argv[4]);
 
-    DiskSystem disk(filestem);
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(filestem));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
     BufferCache cache(&disk, cachesize);
+    cache.SetTrackReuse(statsjson != 0);
     BTreeIndex btree(keysize, valuesize, &cache);
 
     ERROR_T rc;
@@ -58,6 +70,10 @@ int main(int argc, char **argv) {
 
         cerr << "total time      = " << cache.GetCurrentTime() << endl;
 
+        if (write_stats_json(cache, statsjson) != ERROR_NOERROR) {
+            return -1;
+        }
+
         return 0;
     }
 }
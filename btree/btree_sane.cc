@@ -1,8 +1,10 @@
 #include <stdlib.h>
+#include <memory>
 #include "btree.h"
+#include "toolutil.h"
 
 void usage() {
-    cerr << "usage: btree_sane filestem cachesize\n";
+    cerr << "usage: btree_sane filestem cachesize [--stats-json file]\n";
 }
 
 
@@ -10,6 +12,10 @@ int main(int argc, char **argv) {
     char *filestem;
     SIZE_T cachesize;
     SIZE_T superblocknum;
+    char *statsjson;
+
+    // --stats-json file, if given, comes last
+    statsjson = take_stats_json(argc, argv);
 
     if (argc != 3) {
         usage();
@@ -19,8 +25,14 @@ int main(int argc, char **argv) {
     filestem = argv[1];
     cachesize = atoi(argv[2]);
 
-    DiskSystem disk(filestem);
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(filestem));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
     BufferCache cache(&disk, cachesize);
+    cache.SetTrackReuse(statsjson != 0);
     BTreeIndex btree(0, 0, &cache);
 
     ERROR_T rc;
@@ -62,6 +74,10 @@ int main(int argc, char **argv) {
 
         cerr << "total time      = " << cache.GetCurrentTime() << endl;
 
+        if (write_stats_json(cache, statsjson) != ERROR_NOERROR) {
+            return -1;
+        }
+
         return 0;
     }
 }
@@ -1,232 +1,2042 @@
+#include <algorithm>
+#include <vector>
+#include <string.h>
+#include <sys/mman.h>
+
 #include "buffercache.h"
 
-ERROR_T BufferCache::CheckDeleteOldest() {
-    // In a real buffer cache, we would use a priority queue to make this O(1)
 
-    map<SIZE_T, Block, cache_compare_lessthan>::iterator oldestptr = blockmap.end();
-    double oldest = curtime + 1;
+// Frames start on cache line boundaries
+const SIZE_T CACHE_LINE_BYTES = 64;
+const size_t HUGE_PAGE_BYTES = 2 * 1024 * 1024;
+// Longest multi-block write we issue
+const SIZE_T MAX_WRITE_RUN = 64;
+// and read
+const SIZE_T MAX_READ_RUN = 64;
+// Readahead windows start here and double up to the limit
+const SIZE_T INITIAL_READAHEAD = 4;
+const SIZE_T MAX_READAHEAD = 64;
+// Reads further apart than this are not a stream
+const SIZE_T MAX_READAHEAD_STRIDE = 8;
+// Frames scans get to themselves, unless the cache is small
+const SIZE_T DEFAULT_SCAN_RING = 16;
+// A lookup table node (next pointer and entry) with its allocator
+// header, and the bucket pointing at it
+const size_t FRAME_MAP_BYTES = sizeof(void *) + sizeof(pair<const SIZE_T, BufferFrame *>) + 2 * sizeof(void *);
+// Warm-up reads run through gaps this short rather than seek over them
+const SIZE_T MAX_WARMUP_GAP = 4;
+const char *WARMUP_SUFFIX = ".warmup";
+
+
+static bool frame_blocknum_lessthan(const BufferFrame *f1, const BufferFrame *f2) {
+    return f1->blocknum < f2->blocknum;
+}
+
+// Holds a mutex until the end of the enclosing scope
+class ScopedLock {
+private:
+    pthread_mutex_t *mutex;
+public:
+    ScopedLock(pthread_mutex_t *m) : mutex(m) { pthread_mutex_lock(mutex); }
+
+    ~ScopedLock() { pthread_mutex_unlock(mutex); }
+};
+
+
+BufferShard::BufferShard() :
+        numframes(0), targetframes(0), policy(0), accesscount(0), numinflight(0),
+        reads(0), writes(0), hits(0), misses(0), prefetches(0), prefetchhits(0),
+        evictionwrites(0), cleanevictions(0), readaheads(0), readaheadhits(0),
+        ringsize(0), ringrecycles(0), elidedwrites(0), retainsize(0), retainedhits(0) {
+    memset(kindaccesses, 0, sizeof(kindaccesses));
+    pthread_mutex_init(&lock, 0);
+    pthread_cond_init(&framecond, 0);
+}
+
+BufferShard::~BufferShard() {
+    for (SIZE_T i = 0; i < snapshots.size(); i++) {
+        delete[] snapshots[i];
+    }
+    delete policy;
+    pthread_cond_destroy(&framecond);
+    pthread_mutex_destroy(&lock);
+}
+
+
+// Shard s gets an even share of the frames, the first few one extra
+static SIZE_T shard_frames(const SIZE_T numframes, const SIZE_T numshards, const SIZE_T s) {
+    return numframes / numshards + (s < numframes % numshards ? 1 : 0);
+}
+
+ERROR_T BufferCache::AllocateArena() {
+    ScopedLock al(&arenalock);
+
+    blocksize = GetBlockSize();
+    framebytes = (blocksize + CACHE_LINE_BYTES - 1) / CACHE_LINE_BYTES * CACHE_LINE_BYTES;
+    ERROR_T rc = AllocateExtent(numframes);
+
+    // Each shard gets a contiguous run of frames
+    for (SIZE_T s = 0; s < numshards; s++) {
+        SIZE_T n = rc == ERROR_NOERROR ? shard_frames(numframes, numshards, s) : 0;
+        shards[s].blockmap.reserve(n);
+        shards[s].freeframes.clear();
+        shards[s].freeframes.reserve(n);
+        for (SIZE_T i = 0; i < n; i++) {
+            shards[s].freeframes.push_back(spareframes[spareframes.size() - n + i]);
+        }
+        spareframes.resize(spareframes.size() - n);
+        shards[s].numframes = shards[s].targetframes = n;
+    }
+    if (rc == ERROR_NOERROR) {
+        extents[0].numspare = 0;
+    }
+    return rc;
+}
+
+void BufferCache::FreeArena() {
+    ScopedLock al(&arenalock);
+
+    while (!extents.empty()) {
+        FreeExtent(extents.size() - 1);
+    }
+    spareframes.clear();
+    for (SIZE_T s = 0; s < numshards; s++) {
+        shards[s].freeframes.clear();
+        shards[s].numframes = 0;
+    }
+}
+
+ERROR_T BufferCache::AllocateExtent(const SIZE_T n) {
+    FrameExtent e;
+    void *p = MAP_FAILED;
+
+    e.arenabytes = (size_t) n * framebytes;
+    e.hugetlb = false;
+#ifdef MAP_HUGETLB
+    if (hugepages) {
+        size_t len = (e.arenabytes + HUGE_PAGE_BYTES - 1) / HUGE_PAGE_BYTES * HUGE_PAGE_BYTES;
+        p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (p != MAP_FAILED) {
+            e.arenabytes = len;
+            e.hugetlb = true;
+        }
+    }
+#endif
+    if (p == MAP_FAILED) {
+        p = mmap(0, e.arenabytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return ERROR_NOMEM;
+        }
+#ifdef MADV_HUGEPAGE
+        if (hugepages) {
+            // no reserved huge pages, so settle for transparent ones
+            madvise(p, e.arenabytes, MADV_HUGEPAGE);
+        }
+#endif
+    }
+    e.arena = (BYTE_T *) p;
+    e.frames = new BufferFrame[n];
+    e.numframes = e.numspare = n;
+    e.retiring = false;
+    // Lowest first off the back of the pool
+    for (SIZE_T i = n; i > 0; i--) {
+        e.frames[i - 1].data = e.arena + (size_t) (i - 1) * framebytes;
+        spareframes.push_back(&e.frames[i - 1]);
+    }
+    extents.push_back(e);
+    return ERROR_NOERROR;
+}
+
+void BufferCache::FreeExtent(const SIZE_T i) {
+    FrameExtent &e = extents[i];
+    SIZE_T kept = 0;
+
+    for (SIZE_T j = 0; j < spareframes.size(); j++) {
+        if (!e.Holds(spareframes[j])) {
+            spareframes[kept++] = spareframes[j];
+        }
+    }
+    spareframes.resize(kept);
+    munmap(e.arena, e.arenabytes);
+    delete[] e.frames;
+    extents.erase(extents.begin() + i);
+}
+
+FrameExtent *BufferCache::ExtentOf(const BufferFrame *f) {
+    for (SIZE_T i = 0; i < extents.size(); i++) {
+        if (extents[i].Holds(f)) {
+            return &extents[i];
+        }
+    }
+    return 0;
+}
+
+void BufferCache::AddSpare(BufferFrame *f) {
+    FrameExtent *e = ExtentOf(f);
+    spareframes.push_back(f);
+    if (++e->numspare == e->numframes) {
+        FreeExtent(e - &extents[0]);
+    }
+}
+
+BufferFrame *BufferCache::TakeSpare() {
+    for (SIZE_T i = spareframes.size(); i > 0; i--) {
+        BufferFrame *f = spareframes[i - 1];
+        FrameExtent *e = ExtentOf(f);
+        if (!e->retiring) {
+            spareframes.erase(spareframes.begin() + (i - 1));
+            e->numspare--;
+            return f;
+        }
+    }
+    return 0;
+}
+
+
+void BufferCache::LockAllShards() {
+    // Once a shard is drained and held nothing new can be fetched into it,
+    // so the prefetcher never waits on a shard we hold
+    for (SIZE_T s = 0; s < numshards; s++) {
+        pthread_mutex_lock(&shards[s].lock);
+        WaitForFetches(shards[s]);
+    }
+}
+
+void BufferCache::UnlockAllShards() {
+    for (SIZE_T s = numshards; s > 0; s--) {
+        pthread_mutex_unlock(&shards[s - 1].lock);
+    }
+}
+
+
+BufferFrame *BufferCache::AddFrame(BufferShard &s, const SIZE_T blocknum, const bool lowpriority) {
+    if (s.freeframes.empty()) {
+        return 0;
+    }
+    BufferFrame *f = s.freeframes.back();
+    s.freeframes.pop_back();
+    f->Reset(blocknum);
+    s.blockmap[blocknum] = f;
+    if (lowpriority) {
+        s.policy->InsertLowPriority(f);
+    } else {
+        s.policy->Insert(f);
+    }
+    return f;
+}
+
+void BufferCache::Touch(BufferShard &s, BufferFrame *f) {
+    // curtime only advances on disk I/O, so it cannot order hits
+    if (f->retained) {
+        s.retained.Remove(f);
+        s.retained.PushFront(f);
+    } else {
+        s.policy->Touch(f);
+    }
+    f->lastaccess = ++s.accesscount;
+}
+
+// Waits for a block being read or written to settle, charging any part
+// of a prefetch that has not finished yet in simulated time as a stall
+BufferFrame *BufferCache::FindFrame(BufferShard &s, const SIZE_T blocknum) {
+    unordered_map<SIZE_T, BufferFrame *>::iterator b;
+
+    while ((b = s.blockmap.find(blocknum)) != s.blockmap.end() && (*b).second->inflight) {
+        pthread_cond_wait(&s.framecond, &s.lock);
+    }
+    if (b == s.blockmap.end()) {
+        return 0;
+    }
+    BufferFrame *f = (*b).second;
+    if (f->prefetched) {
+        pthread_mutex_lock(&disklock);
+        if (f->readytime > curtime) {
+            stalltime += f->readytime - curtime;
+            missstalltime += f->readytime - curtime;
+            curtime = f->readytime;
+        }
+        pthread_mutex_unlock(&disklock);
+        f->prefetched = false;
+        if (!f->readahead) {
+            s.prefetchhits++;
+        }
+    }
+    return f;
+}
+
+void BufferCache::WaitForFetches(BufferShard &s) {
+    while (s.numinflight > 0) {
+        pthread_cond_wait(&s.framecond, &s.lock);
+    }
+}
+
+// Requires disklock
+double BufferCache::ScheduleDiskRequest(const SIZE_T blocknum, const SIZE_T num, const double issuetime,
+                                        const double reqtime, const bool write) {
+    double done = disk->ScheduleRequest(blocknum, num, write, issuetime, reqtime);
+
+    if (write) {
+        writelatency.Add(done - issuetime);
+    } else {
+        readlatency.Add(done - issuetime);
+    }
+    if (done > lastcompletion) {
+        lastcompletion = done;
+    }
+    return done;
+}
+
+ERROR_T BufferCache::ReadFromDisk(const SIZE_T blocknum, BYTE_T *data) {
+    double reqtime, done;
+    ERROR_T rc;
+
+    ScopedLock l(&disklock);
+    rc = disk->Read(blocknum, 1, data, reqtime);
+    done = ScheduleDiskRequest(blocknum, 1, curtime, reqtime, false);
+    stalltime += done - curtime;
+    missstalltime += done - curtime;
+    curtime = done;
+    diskreads++;
+    diskreadrequests++;
+    return rc;
+}
+
+ERROR_T BufferCache::WriteToDisk(const SIZE_T blocknum, BYTE_T *data, const bool background) {
+    double reqtime, done;
+    ERROR_T rc;
+
+    ScopedLock l(&disklock);
+    rc = disk->Write(blocknum, 1, data, reqtime);
+    done = ScheduleDiskRequest(blocknum, 1, curtime, reqtime, true);
+    if (background) {
+        backgroundwrites++;
+    } else {
+        stalltime += done - curtime;
+        writebackstalltime += done - curtime;
+        curtime = done;
+    }
+    diskwrites++;
+    diskwriterequests++;
+    return rc;
+}
+
+ERROR_T BufferCache::WriteRunToDisk(const vector<BufferFrame *> &run, const bool background) {
+    if (run.size() == 1) {
+        return WriteToDisk(run[0]->blocknum, run[0]->data, background);
+    }
+
+    double reqtime, done;
+    ERROR_T rc;
+    struct iovec iov[MAX_WRITE_RUN];
+
+    // Straight from the frames
+    for (SIZE_T i = 0; i < run.size(); i++) {
+        iov[i].iov_base = run[i]->data;
+        iov[i].iov_len = blocksize;
+    }
+
+    ScopedLock l(&disklock);
+    rc = disk->Write(run[0]->blocknum, run.size(), iov, run.size(), reqtime);
+    done = ScheduleDiskRequest(run[0]->blocknum, run.size(), curtime, reqtime, true);
+    if (background) {
+        backgroundwrites += run.size();
+    } else {
+        stalltime += done - curtime;
+        writebackstalltime += done - curtime;
+        curtime = done;
+    }
+    diskwrites += run.size();
+    diskwriterequests++;
+    return rc;
+}
+
+ERROR_T BufferCache::SyncDisk() {
+    ScopedLock l(&disklock);
+    return disk->Sync();
+}
+
+void BufferCache::ReleaseRun(const vector<BufferFrame *> &run, const ERROR_T rc) {
+    for (SIZE_T i = 0; i < run.size(); i++) {
+        BufferFrame *f = run[i];
+        BufferShard &s = ShardFor(f->blocknum);
+        ScopedLock l(&s.lock);
+        if (rc == ERROR_NOERROR) {
+            SetDirty(f, false);
+        }
+        f->pincount--;
+        f->sharedlatches--;
+        s.numinflight--;
+        pthread_cond_broadcast(&s.framecond);
+    }
+}
+
+ERROR_T BufferCache::WriteRuns(const vector<SIZE_T> &blocknums, const bool background, const SIZE_T target, SIZE_T &written) {
+    vector<BufferFrame *> run;
+    ERROR_T rc = ERROR_NOERROR;
+
+    written = 0;
+    for (SIZE_T i = 0; i <= blocknums.size(); i++) {
+        BufferFrame *f = 0;
+
+        if (i < blocknums.size()) {
+            if (run.empty()) {
+                pthread_mutex_lock(&writerlock);
+                bool done = numdirty <= target || (background && writerstop);
+                pthread_mutex_unlock(&writerlock);
+                if (done) {
+                    break;
+                }
+            }
+            BufferShard &s = ShardFor(blocknums[i]);
+            pthread_mutex_lock(&s.lock);
+            f = LatchForWrite(s, blocknums[i]);
+            pthread_mutex_unlock(&s.lock);
+        }
+
+        // The run ends at a gap, at a block we can't write, or when it is long enough
+        if (!run.empty() && (!f || f->blocknum != run.back()->blocknum + 1 || run.size() >= MAX_WRITE_RUN)) {
+            ERROR_T r = WriteRunToDisk(run, background);
+            ReleaseRun(run, r);
+            if (r == ERROR_NOERROR) {
+                written += run.size();
+            } else if (rc == ERROR_NOERROR) {
+                rc = r;
+            }
+            run.clear();
+        }
+        if (f) {
+            run.push_back(f);
+        }
+    }
+    return rc;
+}
+
+void BufferCache::ScheduleWrites(vector <pair<SIZE_T, SIZE_T> > &dirty, vector<SIZE_T> &blocknums) {
+    DiskSchedulerType type;
+    SIZE_T head;
+    double now;
+
+    pthread_mutex_lock(&disklock);
+    type = schedtype;
+    head = disk->GetHeadPosition();
+    now = curtime;
+    pthread_mutex_unlock(&disklock);
+
+    // Oldest dirty first, as they would have arrived
+    sort(dirty.begin(), dirty.end());
+    blocknums.clear();
+    for (SIZE_T i = 0; i < dirty.size(); i++) {
+        blocknums.push_back(dirty[i].second);
+    }
+    DiskScheduler *sched = DiskScheduler::Create(type);
+    sched->Order(blocknums, true, head, now);
+    delete sched;
+}
+
+void BufferCache::SetDirty(BufferFrame *f, const bool dirty) {
+    if (f->dirty == dirty) {
+        return;
+    }
+    f->dirty = dirty;
+    ScopedLock l(&writerlock);
+    if (dirty) {
+        numdirty++;
+        f->dirtyseq = ++dirtycount;
+        if (writerrunning && numdirty > dirtythreshold * numframes) {
+            pthread_cond_signal(&writercond);
+        }
+    } else {
+        numdirty--;
+    }
+}
+
+BufferFrame *BufferCache::LatchForWrite(BufferShard &s, const SIZE_T blocknum) {
+    unordered_map<SIZE_T, BufferFrame *>::iterator b = s.blockmap.find(blocknum);
+
+    if (b == s.blockmap.end()) {
+        return 0;
+    }
+    BufferFrame *f = (*b).second;
+    if (!f->dirty || f->inflight || f->exclusivelatch) {
+        return 0;
+    }
+    // A shared latch keeps the bytes still but lets readers in
+    f->pincount++;
+    f->sharedlatches++;
+    s.numinflight++;
+    return f;
+}
+
+void BufferCache::GatherDirtyNeighbours(BufferShard &s, BufferFrame *victim, vector<BufferFrame *> &run) {
+    vector<BufferFrame *> below;
+    BufferFrame *f;
+
+    // Shards are locked in no particular order here, so only try them
+    for (SIZE_T b = victim->blocknum; b > 0 && below.size() + run.size() + 1 < MAX_WRITE_RUN; b--) {
+        BufferShard &t = ShardFor(b - 1);
+        if (&t != &s && pthread_mutex_trylock(&t.lock)) {
+            break;
+        }
+        f = LatchForWrite(t, b - 1);
+        if (&t != &s) {
+            pthread_mutex_unlock(&t.lock);
+        }
+        if (!f) {
+            break;
+        }
+        below.push_back(f);
+    }
+    run.insert(run.end(), below.rbegin(), below.rend());
+    run.push_back(victim);
+    for (SIZE_T b = victim->blocknum + 1; b < disk->GetNumBlocks() && run.size() < MAX_WRITE_RUN; b++) {
+        BufferShard &t = ShardFor(b);
+        if (&t != &s && pthread_mutex_trylock(&t.lock)) {
+            break;
+        }
+        f = LatchForWrite(t, b);
+        if (&t != &s) {
+            pthread_mutex_unlock(&t.lock);
+        }
+        if (!f) {
+            break;
+        }
+        run.push_back(f);
+    }
+}
+
+ERROR_T BufferCache::WriteBack(BufferFrame *f) {
+    if (f->dirty) {
+        ERROR_T rc = WriteToDisk(f->blocknum, f->data, false);
+        if (rc != ERROR_NOERROR) {
+            return rc;
+        }
+        SetDirty(f, false);
+    }
+    return ERROR_NOERROR;
+}
+
+void BufferCache::DropFrame(BufferShard &s, BufferFrame *f, const bool evicted) {
+    if (f->retained) {
+        s.retained.Remove(f);
+    } else {
+        s.policy->Remove(f, evicted);
+    }
+    s.blockmap.erase(f->blocknum);
+    f->Reset(0);
+    FreeFrame(s, f);
+}
+
+void BufferCache::FreeFrame(BufferShard &s, BufferFrame *f) {
+    if (s.numframes <= s.targetframes) {
+        s.freeframes.push_back(f);
+        return;
+    }
+    ScopedLock al(&arenalock);
+    s.numframes--;
+    AddSpare(f);
+}
+
+void BufferCache::DropAllFrames(BufferShard &s) {
+    for (unordered_map<SIZE_T, BufferFrame *>::iterator i = s.blockmap.begin(); i != s.blockmap.end(); ++i) {
+        SetDirty((*i).second, false);
+        (*i).second->Reset(0);
+        FreeFrame(s, (*i).second);
+    }
+    s.blockmap.clear();
+    s.ring.clear();
+    s.retained.Clear();
+    s.policy->Clear();
+}
+
+void BufferCache::MoveFrame(BufferShard &s, BufferFrame *from, BufferFrame *to) {
+    BYTE_T *data = to->data;
+
+    *to = *from;
+    to->data = data;
+    memcpy(to->data, from->data, blocksize);
+    if (to->retained) {
+        s.retained.Replace(from, to);
+    } else {
+        s.policy->Replace(from, to);
+    }
+    s.blockmap[to->blocknum] = to;
+    for (SIZE_T i = 0; i < s.ring.size(); i++) {
+        if (s.ring[i].first == from) {
+            s.ring[i].first = to;
+        }
+    }
+    from->Reset(0);
+}
+
+void BufferCache::CompactShard(BufferShard &s) {
+    ScopedLock al(&arenalock);
+
+    // Free frames first, since they cost nothing to swap
+    for (SIZE_T i = 0; i < s.freeframes.size(); i++) {
+        BufferFrame *f = s.freeframes[i];
+        if (ExtentOf(f)->retiring) {
+            BufferFrame *g = TakeSpare();
+            if (!g) {
+                return;
+            }
+            s.freeframes[i] = g;
+            AddSpare(f);
+        }
+    }
+    vector<BufferFrame *> doomed;
+    for (unordered_map<SIZE_T, BufferFrame *>::iterator i = s.blockmap.begin(); i != s.blockmap.end(); ++i) {
+        BufferFrame *f = (*i).second;
+        if (f->IsEvictable() && ExtentOf(f)->retiring) {
+            doomed.push_back(f);
+        }
+    }
+    for (SIZE_T i = 0; i < doomed.size(); i++) {
+        BufferFrame *g = TakeSpare();
+        if (!g) {
+            return;
+        }
+        MoveFrame(s, doomed[i], g);
+        AddSpare(doomed[i]);
+    }
+}
+
+ERROR_T BufferCache::CheckDeleteOldest(BufferShard &s, const SIZE_T incoming) {
+    // Only delete if the shard is full
+    while (s.freeframes.empty()) {
+        // write and delete the block the policy picks
+        BufferFrame *victim = s.policy->Victim(incoming);
+        if (victim && victim->dirty) {
+            // Write it with the shard unlocked; in flight, nobody can pin it
+            vector<BufferFrame *> run;
+            victim->inflight = true;
+            s.numinflight++;
+            if (coalesceevictions) {
+                GatherDirtyNeighbours(s, victim, run);
+            } else {
+                run.push_back(victim);
+            }
+            pthread_mutex_unlock(&s.lock);
+            ERROR_T rc = WriteRunToDisk(run, false);
+            run.erase(find(run.begin(), run.end(), victim));
+            ReleaseRun(run, rc);
+            pthread_mutex_lock(&s.lock);
+            victim->inflight = false;
+            s.numinflight--;
+            pthread_cond_broadcast(&s.framecond);
+            if (rc != ERROR_NOERROR) {
+                return rc;
+            }
+            SetDirty(victim, false);
+            s.evictionwrites++;
+            DropFrame(s, victim, true);
+        } else if (victim) {
+            // an unused readahead block leaves no history behind
+            DropFrame(s, victim, !victim->readahead);
+            s.cleanevictions++;
+        } else if ((victim = s.retained.LastEvictable())) {
+            // only upper levels are left to give up
+            Release(s, victim);
+        } else if (s.numinflight > 0) {
+            // a read or write will free up its frame soon
+            pthread_cond_wait(&s.framecond, &s.lock);
+        } else {
+            return ERROR_NOSPACE;
+        }
+    }
+    return ERROR_NOERROR;
+}
+
+void *BufferCache::PrefetcherMain(void *cache) {
+    ((BufferCache *) cache)->PrefetcherLoop();
+    return 0;
+}
+
+void BufferCache::PrefetcherLoop() {
+    vector<BufferFrame *> run;
+    struct iovec iov[MAX_READ_RUN];
+
+    run.reserve(MAX_READ_RUN);
+    pthread_mutex_lock(&prefetchlock);
+    while (true) {
+        while (prefetchqueue->IsEmpty() && !prefetcherstop) {
+            pthread_cond_wait(&prefetchcond, &prefetchlock);
+        }
+        if (prefetchqueue->IsEmpty()) {
+            break;
+        }
+        pthread_mutex_lock(&disklock);
+        SIZE_T head = disk->GetHeadPosition();
+        double now = curtime;
+        pthread_mutex_unlock(&disklock);
+
+        // Queued blocks that follow the picked one go out in the same read
+        DiskRequest r = prefetchqueue->Next(head, now);
+        double issuetime = r.issuetime;
+        run.clear();
+        run.push_back(r.frame);
+        while (run.size() < MAX_READ_RUN && prefetchqueue->Take(run.back()->blocknum + 1, r)) {
+            run.push_back(r.frame);
+            issuetime = r.issuetime > issuetime ? r.issuetime : issuetime;
+        }
+        pthread_mutex_unlock(&prefetchlock);
+
+        // Nobody else touches an in-flight frame, so the disk can fill it
+        // with the shard unlocked
+        double reqtime, done;
+        for (SIZE_T i = 0; i < run.size(); i++) {
+            iov[i].iov_base = run[i]->data;
+            iov[i].iov_len = blocksize;
+        }
+        pthread_mutex_lock(&disklock);
+        ERROR_T rc = disk->Read(run[0]->blocknum, run.size(), iov, run.size(), reqtime);
+        done = ScheduleDiskRequest(run[0]->blocknum, run.size(), issuetime, reqtime, false);
+        diskreads += run.size();
+        diskreadrequests++;
+        pthread_mutex_unlock(&disklock);
+
+        for (SIZE_T i = 0; i < run.size(); i++) {
+            BufferFrame *f = run[i];
+            BufferShard &s = ShardFor(f->blocknum);
+            pthread_mutex_lock(&s.lock);
+            f->inflight = false;
+            f->readytime = done;
+            if (rc != ERROR_NOERROR) {
+                DropFrame(s, f, false);
+            }
+            s.numinflight--;
+            pthread_cond_broadcast(&s.framecond);
+            pthread_mutex_unlock(&s.lock);
+        }
+
+        pthread_mutex_lock(&prefetchlock);
+    }
+    pthread_mutex_unlock(&prefetchlock);
+}
+
+void *BufferCache::WriterMain(void *cache) {
+    ((BufferCache *) cache)->WriterLoop();
+    return 0;
+}
+
+void BufferCache::WriterLoop() {
+    bool stuck = false;
+
+    pthread_mutex_lock(&writerlock);
+    while (true) {
+        // If the last pass found nothing it could write, wait for more dirt
+        while (!writerstop && (stuck || numdirty <= dirtythreshold * numframes)) {
+            pthread_cond_wait(&writercond, &writerlock);
+            stuck = false;
+        }
+        if (writerstop) {
+            break;
+        }
+        SIZE_T target = (SIZE_T) (dirtythreshold * numframes / 2);
+        pthread_mutex_unlock(&writerlock);
+        stuck = CleanFrames(target) == 0;
+        pthread_mutex_lock(&writerlock);
+    }
+    pthread_mutex_unlock(&writerlock);
+}
+
+SIZE_T BufferCache::CleanFrames(const SIZE_T target) {
+    vector <pair<SIZE_T, SIZE_T> > dirty;
+    vector<SIZE_T> blocknums;
+    SIZE_T written = 0;
+
+    for (SIZE_T s = 0; s < numshards; s++) {
+        ScopedLock l(&shards[s].lock);
+        for (unordered_map<SIZE_T, BufferFrame *>::iterator i = shards[s].blockmap.begin(); i != shards[s].blockmap.end(); ++i) {
+            if ((*i).second->dirty) {
+                dirty.push_back(make_pair((*i).second->dirtyseq, (*i).first));
+            }
+        }
+    }
+    ScheduleWrites(dirty, blocknums);
+    WriteRuns(blocknums, true, target, written);
+    return written;
+}
+
+void BufferCache::StopWriter() {
+    pthread_mutex_lock(&writerlock);
+    if (!writerrunning) {
+        pthread_mutex_unlock(&writerlock);
+        return;
+    }
+    writerstop = true;
+    pthread_cond_signal(&writercond);
+    pthread_mutex_unlock(&writerlock);
+    pthread_join(writer, 0);
+    writerrunning = false;
+    writerstop = false;
+}
+
+void BufferCache::StopPrefetcher() {
+    pthread_mutex_lock(&prefetchlock);
+    if (!prefetcherrunning) {
+        pthread_mutex_unlock(&prefetchlock);
+        return;
+    }
+    prefetcherstop = true;
+    pthread_cond_signal(&prefetchcond);
+    pthread_mutex_unlock(&prefetchlock);
+    pthread_join(prefetcher, 0);
+    prefetcherrunning = false;
+    prefetcherstop = false;
+}
+
+BufferCache::BufferCache(DiskSystem *d, SIZE_T cs, const ReplacementPolicyType pt, const bool hp, const SIZE_T ns) :
+        disk(d), cachesize(cs), blocksize(0), hugepages(hp), framebytes(0),
+        curtime(0), stalltime(0), missstalltime(0), writebackstalltime(0),
+        allocs(0), deallocs(0), diskreads(0), diskwrites(0),
+        diskreadrequests(0), diskwriterequests(0), coalesceevictions(false), elidewrites(true),
+        warmup(false), warmupblocks(0), warmuptime(0), reuse(0),
+        prefetchqueue(DiskScheduler::Create(DISKSCHED_CLOOK)), schedtype(DISKSCHED_CLOOK), lastcompletion(0),
+        prefetcherrunning(false), prefetcherstop(false),
+        ringframes(0), retainframes(0), maxreadahead(0), streamclock(0),
+        dirtythreshold(0), numdirty(0), dirtycount(0), backgroundwrites(0),
+        writerrunning(false), writerstop(false) {
+    pthread_mutex_init(&disklock, 0);
+    pthread_mutex_init(&prefetchlock, 0);
+    pthread_cond_init(&prefetchcond, 0);
+    pthread_mutex_init(&writerlock, 0);
+    pthread_cond_init(&writercond, 0);
+    pthread_mutex_init(&readaheadlock, 0);
+    memset(streams, 0, sizeof(streams));
+    pthread_mutex_init(&reuselock, 0);
+    pthread_mutex_init(&arenalock, 0);
+
+    numframes = cachesize > 0 ? cachesize : 1;
+    numshards = ns < 1 ? 1 : ns > numframes ? numframes : ns;
+    shards = new BufferShard[numshards];
+    for (SIZE_T s = 0; s < numshards; s++) {
+        shards[s].policy = ReplacementPolicy::Create(pt, shard_frames(numframes, numshards, s));
+    }
+    AllocateArena();
+    SetScanRing(DEFAULT_SCAN_RING);
+    // The disk queues requests on our clock, which starts at 0
+    disk->ResetSchedule();
+}
+
+
+BufferCache::~BufferCache() {
+    StopWriter();
+    if (disk) {
+        Detach();
+    }
+    StopPrefetcher();
+    for (SIZE_T s = 0; s < numshards; s++) {
+        DropAllFrames(shards[s]);
+    }
+    FreeArena();
+    delete[] shards;
+    delete prefetchqueue;
+    delete reuse;
+    pthread_mutex_destroy(&arenalock);
+    pthread_mutex_destroy(&reuselock);
+    pthread_mutex_destroy(&readaheadlock);
+    pthread_cond_destroy(&writercond);
+    pthread_mutex_destroy(&writerlock);
+    pthread_cond_destroy(&prefetchcond);
+    pthread_mutex_destroy(&prefetchlock);
+    pthread_mutex_destroy(&disklock);
+    disk = 0;
+    cachesize = 0;
+    curtime = 0;
+}
+
+ERROR_T BufferCache::Attach() {
+    ERROR_T rc;
+
+    LockAllShards();
+    for (SIZE_T s = 0; s < numshards; s++) {
+        DropAllFrames(shards[s]);
+    }
+    FreeArena();
+    rc = AllocateArena();
+    if (rc == ERROR_NOERROR && warmup) {
+        rc = LoadWarmupList();
+    }
+    UnlockAllShards();
+    return rc;
+}
+
+ERROR_T BufferCache::Detach() {
+    ERROR_T rc = ERROR_NOERROR;
+
+    LockAllShards();
+
+    // write out all of our data in one sweep and then throw it away
+
+    vector <pair<SIZE_T, SIZE_T> > dirty;
+    vector<SIZE_T> dirtyblocks;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        for (unordered_map<SIZE_T, BufferFrame *>::iterator i = shards[s].blockmap.begin(); i != shards[s].blockmap.end(); ++i) {
+            if ((*i).second->dirty) {
+                dirty.push_back(make_pair((*i).second->dirtyseq, (*i).first));
+            }
+        }
+    }
+    ScheduleWrites(dirty, dirtyblocks);
+    vector<BufferFrame *> run;
+    for (SIZE_T i = 0; i <= dirtyblocks.size() && rc == ERROR_NOERROR; i++) {
+        BufferFrame *f = i < dirtyblocks.size() ? ShardFor(dirtyblocks[i]).blockmap[dirtyblocks[i]] : 0;
+        if (!run.empty() && (!f || f->blocknum != run.back()->blocknum + 1 || run.size() >= MAX_WRITE_RUN)) {
+            if ((rc = WriteRunToDisk(run, false)) == ERROR_NOERROR) {
+                for (SIZE_T j = 0; j < run.size(); j++) {
+                    SetDirty(run[j], false);
+                }
+            }
+            run.clear();
+        }
+        if (f) {
+            run.push_back(f);
+        }
+    }
+    if (rc == ERROR_NOERROR) {
+        rc = SyncDisk();
+    }
+    if (rc == ERROR_NOERROR) {
+        SaveWarmupList();
+        for (SIZE_T s = 0; s < numshards; s++) {
+            DropAllFrames(shards[s]);
+        }
+    }
+    UnlockAllShards();
+    return rc;
+}
+
+ERROR_T BufferCache::LoadWarmupList() {
+    string name = disk->GetFileStem() + WARMUP_SUFFIX;
+    FILE *file = fopen(name.c_str(), "r");
+    char buf[80];
+    SIZE_T bs = 0, nb = 0, blocknum;
+    bool header = true;
+    vector<SIZE_T> room(numshards);
+    vector<SIZE_T> wanted;      // hottest first
+
+    if (!file) {
+        return ERROR_NOERROR;
+    }
+    for (SIZE_T s = 0; s < numshards; s++) {
+        room[s] = shards[s].freeframes.size();
+    }
+    while (fgets(buf, 80, file)) {
+        if (buf[0] == '#') {
+            continue;
+        }
+        if (header) {
+            if (sscanf(buf, "%u %u", &bs, &nb) != 2 || bs != blocksize || nb != disk->GetNumBlocks()) {
+                // made for some other disk
+                break;
+            }
+            header = false;
+        } else if (sscanf(buf, "%u", &blocknum) == 1 && blocknum < nb && room[blocknum % numshards] > 0) {
+            room[blocknum % numshards]--;
+            wanted.push_back(blocknum);
+        }
+    }
+    fclose(file);
+
+    // Coldest first, so the policy ends up ordered as it was
+    for (SIZE_T i = wanted.size(); i > 0; i--) {
+        BufferShard &s = ShardFor(wanted[i - 1]);
+        if (s.blockmap.find(wanted[i - 1]) == s.blockmap.end()) {
+            BufferFrame *f = AddFrame(s, wanted[i - 1]);
+            f->lastaccess = ++s.accesscount;
+        }
+    }
+
+    // Read into the frames, and the blocks between them into gap
+    struct iovec iov[MAX_READ_RUN];
+    vector<BYTE_T> gap(blocksize);
+
+    sort(wanted.begin(), wanted.end());
+    wanted.erase(unique(wanted.begin(), wanted.end()), wanted.end());
+    for (SIZE_T i = 0; i < wanted.size();) {
+        SIZE_T j = i + 1;
+        while (j < wanted.size() && wanted[j] - wanted[j - 1] <= MAX_WARMUP_GAP + 1
+               && wanted[j] - wanted[i] < MAX_READ_RUN) {
+            j++;
+        }
+        SIZE_T first = wanted[i], num = wanted[j - 1] - first + 1;
+        double reqtime, done;
+        for (SIZE_T b = first, k = i; b < first + num; b++) {
+            iov[b - first].iov_base = b == wanted[k] ? ShardFor(b).blockmap[wanted[k++]]->data : gap.data();
+            iov[b - first].iov_len = blocksize;
+        }
+        pthread_mutex_lock(&disklock);
+        ERROR_T rc = disk->Read(first, num, iov, num, reqtime);
+        done = ScheduleDiskRequest(first, num, curtime, reqtime, false);
+        stalltime += done - curtime;
+        missstalltime += done - curtime;
+        warmuptime += done - curtime;
+        curtime = done;
+        diskreads += num;
+        diskreadrequests++;
+        pthread_mutex_unlock(&disklock);
+
+        for (; i < j; i++) {
+            BufferShard &s = ShardFor(wanted[i]);
+            BufferFrame *f = s.blockmap[wanted[i]];
+            if (rc == ERROR_NOERROR) {
+                warmupblocks++;
+            } else {
+                DropFrame(s, f, false);
+            }
+        }
+    }
+    return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::SaveWarmupList() {
+    string name = disk->GetFileStem() + WARMUP_SUFFIX;
+    vector<pair<double, SIZE_T> > hot;
+
+    for (SIZE_T s = 0; s < numshards; s++) {
+        for (unordered_map<SIZE_T, BufferFrame *>::const_iterator i = shards[s].blockmap.begin(); i != shards[s].blockmap.end(); ++i) {
+            const BufferFrame *f = (*i).second;
+            // scans and unused readahead aren't what the client comes back to
+            if (!f->scanring && !f->readahead && !f->prefetched) {
+                hot.push_back(make_pair(f->lastaccess, f->blocknum));
+            }
+        }
+    }
+    if (hot.empty()) {
+        // most likely a second Detach, which shouldn't lose the first one's list
+        return ERROR_NOERROR;
+    }
+    sort(hot.begin(), hot.end());
+
+    FILE *file = fopen(name.c_str(), "w");
+    if (!file) {
+        return ERROR_NOFILE;
+    }
+    fprintf(file, "# buffercache warm-up list version 1\n");
+    fprintf(file, "# blocksize numblocks\n");
+    fprintf(file, "%u %u\n", blocksize, disk->GetNumBlocks());
+    fprintf(file, "# blocks, most recently used first\n");
+    for (SIZE_T i = hot.size(); i > 0; i--) {
+        fprintf(file, "%u\n", hot[i - 1].second);
+    }
+    fclose(file);
+    return ERROR_NOERROR;
+}
+
+
+SIZE_T BufferCache::GetCacheSize() const {
+    return cachesize;
+}
+
+size_t BufferCache::GetFrameBytes(const SIZE_T blocksize) {
+    return (blocksize + CACHE_LINE_BYTES - 1) / CACHE_LINE_BYTES * CACHE_LINE_BYTES
+           + sizeof(BufferFrame) + FRAME_MAP_BYTES + sizeof(BufferFrame *);
+}
+
+SIZE_T BufferCache::GetFramesForBudget(const size_t budget, const SIZE_T blocksize) {
+    size_t n = budget / GetFrameBytes(blocksize);
+    return n > 0 ? (SIZE_T) n : 1;
+}
+
+size_t BufferCache::GetMappedBytes() const {
+    size_t n = 0;
+    for (SIZE_T i = 0; i < extents.size(); i++) {
+        n += extents[i].arenabytes;
+    }
+    return n;
+}
+
+ERROR_T BufferCache::Resize(const size_t budget) {
+    SIZE_T n = GetFramesForBudget(budget, GetBlockSize());
+    SIZE_T needed = 0;
+    ERROR_T rc = ERROR_NOERROR;
+
+    if (n < numshards) {
+        n = numshards;
+    }
+    pthread_mutex_lock(&writerlock);
+    numframes = cachesize = n;
+    pthread_mutex_unlock(&writerlock);
+
+    // Shrink first, so the frames given up can go to shards that grow
+    for (SIZE_T i = 0; i < numshards; i++) {
+        BufferShard &s = shards[i];
+        ScopedLock l(&s.lock);
+        s.targetframes = shard_frames(n, numshards, i);
+        s.policy->SetCapacity(s.targetframes);
+        while (s.numframes > s.targetframes) {
+            if (!s.freeframes.empty()) {
+                BufferFrame *f = s.freeframes.back();
+                s.freeframes.pop_back();
+                FreeFrame(s, f);
+            } else if (CheckDeleteOldest(s, 0) != ERROR_NOERROR) {
+                // all pinned; the rest go as they are evicted later
+                break;
+            }
+        }
+        if (s.numframes < s.targetframes) {
+            needed += s.targetframes - s.numframes;
+        }
+    }
+
+    if (needed > 0) {
+        ScopedLock al(&arenalock);
+        for (SIZE_T i = 0; i < extents.size(); i++) {
+            extents[i].retiring = false;
+        }
+        if (spareframes.size() < needed) {
+            rc = AllocateExtent(needed - spareframes.size());
+        }
+    }
+    for (SIZE_T i = 0; i < numshards && needed > 0; i++) {
+        BufferShard &s = shards[i];
+        ScopedLock l(&s.lock);
+        ScopedLock al(&arenalock);
+        while (s.numframes < s.targetframes && !spareframes.empty()) {
+            BufferFrame *f = spareframes.back();
+            spareframes.pop_back();
+            ExtentOf(f)->numspare--;
+            s.freeframes.push_back(f);
+            s.numframes++;
+        }
+    }
+
+    // Blocks scattered over extents that are mostly spare would keep them
+    // all mapped, so pack them into as few extents as will hold the cache
+    if (needed == 0) {
+        bool retiring = false;
+        pthread_mutex_lock(&arenalock);
+        SIZE_T held = 0;
+        for (SIZE_T i = 0; i < extents.size(); i++) {
+            extents[i].retiring = held >= n;
+            retiring = retiring || extents[i].retiring;
+            held += extents[i].numframes;
+        }
+        pthread_mutex_unlock(&arenalock);
+        for (SIZE_T i = 0; i < numshards && retiring; i++) {
+            ScopedLock l(&shards[i].lock);
+            CompactShard(shards[i]);
+        }
+    }
+
+    // Their limits scale with the shards
+    SetScanRing(ringframes);
+    SetRetention(retainframes);
+    return rc;
+}
+
+const char *BufferCache::GetPolicyName() const {
+    return shards[0].policy->GetName();
+}
+
+void BufferCache::SetScheduler(const DiskSchedulerType type) {
+    DiskScheduler *sched = DiskScheduler::Create(type);
+
+    ScopedLock pl(&prefetchlock);
+    prefetchqueue->MoveTo(*sched);
+    delete prefetchqueue;
+    prefetchqueue = sched;
+    ScopedLock l(&disklock);
+    schedtype = type;
+}
+
+const char *BufferCache::GetSchedulerName() const {
+    return prefetchqueue->GetName();
+}
+
+double BufferCache::GetDiskThroughput() const {
+    double end = lastcompletion > curtime ? lastcompletion : curtime;
+    return end > 0 ? (diskreadrequests + diskwriterequests) / (end / 1000) : 0;
+}
 
-    // Only delete if the cache is full
-    if (blockmap.size() < cachesize) {
-        return ERROR_NOERROR;
-    }
 
-    // Find oldest
+SIZE_T BufferCache::GetBlockSize() const {
+    return disk->GetBlockSize();
+}
 
-    for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i = blockmap.begin();
-         i != blockmap.end();
-         ++i) {
-        if ((*i).second.lastaccessed < oldest) {
-            oldestptr = i;
-            oldest = (*i).second.lastaccessed;
-        }
-    }
+SIZE_T BufferCache::GetNumBlocks() const {
+    return disk->GetNumBlocks();
+}
 
-    // write and delete it if it exists
+double BufferCache::GetCurrentTime() const {
+    return curtime;
+}
 
-    if (oldestptr != blockmap.end()) {
-        if ((*oldestptr).second.dirty) {
-            double reqtime;
-            int rc = disk->Write((*oldestptr).first, (*oldestptr).second, reqtime);
-            curtime += reqtime;
-            diskwrites++;
-            if (rc != ERROR_NOERROR) {
-                return rc;
-            }
-        }
-        blockmap.erase(oldestptr);
+void BufferCache::SetReadahead(const SIZE_T maxwindow) {
+    ScopedLock l(&readaheadlock);
+    // Never read ahead more than a quarter of the cache
+    maxreadahead = maxwindow < MAX_READAHEAD ? maxwindow : MAX_READAHEAD;
+    if (maxreadahead > numframes / 4) {
+        maxreadahead = numframes / 4;
     }
-    return ERROR_NOERROR;
+    memset(streams, 0, sizeof(streams));
 }
 
-BufferCache::BufferCache(DiskSystem *d, SIZE_T cs) :
-        disk(d), cachesize(cs), curtime(0),
-        allocs(0), deallocs(0), reads(0), writes(0),
-        diskreads(0), diskwrites(0) { }
+void BufferCache::Readahead(const SIZE_T blocknum) {
+    SIZE_T toread[MAX_READAHEAD];
+    SIZE_T n = 0, last;
+    ReadaheadStream *st = 0;
 
+    {
+        ScopedLock l(&readaheadlock);
+        ReadaheadStream *near = 0, *oldest = &streams[0];
 
-BufferCache::~BufferCache() {
-    if (disk) {
-        Detach();
+        if (maxreadahead == 0) {
+            return;
+        }
+        streamclock++;
+        for (SIZE_T i = 0; i < NUM_READAHEAD_STREAMS; i++) {
+            ReadaheadStream &t = streams[i];
+            if (t.used > 0 && (blocknum == t.last || (t.stride > 0 && blocknum == t.last + t.stride))) {
+                st = &t;
+                break;
+            }
+            if (!near && t.used > 0 && blocknum > t.last && blocknum - t.last <= MAX_READAHEAD_STRIDE) {
+                near = &t;
+            }
+            if (t.used < oldest->used) {
+                oldest = &t;
+            }
+        }
+
+        if (!st) {
+            if (near) {
+                // Two reads a stride apart: a stream, if the next one agrees
+                near->stride = blocknum - near->last;
+            } else {
+                // A random read starts over in the least recently used slot
+                near = oldest;
+                near->stride = 0;
+            }
+            near->last = near->end = blocknum;
+            near->window = 0;
+            near->used = streamclock;
+            return;
+        }
+        st->used = streamclock;
+        if (blocknum == st->last) {
+            // rereading the same block neither advances nor breaks a stream
+            return;
+        }
+        st->last = blocknum;
+        if (st->end < blocknum) {
+            st->end = blocknum;
+        }
+        if (st->window > 0 && st->end - blocknum > st->stride * (st->window / 2)) {
+            // still well ahead; top up in batches so the reads coalesce
+            return;
+        }
+        st->window = st->window == 0 ? INITIAL_READAHEAD : 2 * st->window;
+        if (st->window > maxreadahead) {
+            st->window = maxreadahead;
+        }
+        for (SIZE_T b = st->end + st->stride;
+             b <= blocknum + st->stride * st->window && b < GetNumBlocks() && n < MAX_READAHEAD; b += st->stride) {
+            toread[n++] = b;
+        }
+        if (n == 0) {
+            return;
+        }
+        last = st->end;
+        st->end = toread[n - 1];
     }
-    disk = 0;
-    cachesize = 0;
-    curtime = 0;
-}
 
-ERROR_T BufferCache::Attach() {
-    blockmap.clear();
-    return ERROR_NOERROR;
-}
+    // Make room for the whole batch first.  Each readahead block goes
+    // in last in line, so taking victims one at a time would find the
+    // previous one there and stop.
+    for (SIZE_T i = 0; i < n; i++) {
+        BufferShard &s = ShardFor(toread[i]);
+        ScopedLock l(&s.lock);
+        if (s.blockmap.find(toread[i]) != s.blockmap.end() || !s.freeframes.empty()) {
+            continue;
+        }
+        BufferFrame *victim = s.policy->Victim(toread[i]);
+        if (!victim || victim->dirty || victim->readahead) {
+            break;
+        }
+        DropFrame(s, victim, true);
+        s.cleanevictions++;
+    }
 
-ERROR_T BufferCache::Detach() {
-    // write out all of our data and then throw it away
-
-    for (map<SIZE_T, Block, cache_compare_lessthan>::iterator i = blockmap.begin(); i != blockmap.end(); ++i) {
-        if ((*i).second.dirty) {
-            double reqtime;
-            int rc = disk->Write((*i).first, (*i).second, reqtime);
-            curtime += reqtime;
-            diskwrites++;
-            if (rc != ERROR_NOERROR) {
-                return rc;
-            }
+    SIZE_T started;
+    for (started = 0; started < n; started++) {
+        BufferShard &s = ShardFor(toread[started]);
+        ScopedLock l(&s.lock);
+        if (StartFetch(s, toread[started], true) != ERROR_NOERROR) {
+            // no room without hurting the cache
+            break;
+        }
+    }
+    if (started < n) {
+        // pick up where we stopped next time
+        ScopedLock l(&readaheadlock);
+        if (st->end == toread[n - 1]) {
+            st->end = started > 0 ? toread[started - 1] : last;
         }
     }
-    blockmap.clear();
-    return ERROR_NOERROR;
 }
 
-
-SIZE_T BufferCache::GetCacheSize() const {
-    return cachesize;
+void BufferCache::SetTrackReuse(const bool track, const double samplerate) {
+    ScopedLock l(&reuselock);
+    delete reuse;
+    reuse = track ? new ReuseDistance(samplerate) : 0;
 }
 
+void BufferCache::SetScanRing(const SIZE_T frames) {
+    ringframes = frames;
+    for (SIZE_T i = 0; i < numshards; i++) {
+        BufferShard &s = shards[i];
+        ScopedLock l(&s.lock);
+        // A quarter of the shard at most, so scans can't crowd it out
+        SIZE_T limit = shard_frames(numframes, numshards, i) / 4;
+        s.ringsize = (frames + numshards - 1) / numshards;
+        if (s.ringsize > limit) {
+            s.ringsize = limit > 0 ? limit : 1;
+        }
+        if (frames == 0) {
+            s.ringsize = 0;
+        }
+        for (SIZE_T j = 0; j < s.ring.size(); j++) {
+            s.ring[j].first->scanring = false;
+        }
+        s.ring.clear();
+    }
+}
 
-SIZE_T BufferCache::GetBlockSize() const {
-    return disk->GetBlockSize();
+void BufferCache::SetRetention(const SIZE_T frames) {
+    retainframes = frames;
+    for (SIZE_T i = 0; i < numshards; i++) {
+        BufferShard &s = shards[i];
+        ScopedLock l(&s.lock);
+        // Leaves need room too
+        SIZE_T limit = shard_frames(numframes, numshards, i) * 3 / 4;
+        s.retainsize = (frames + numshards - 1) / numshards;
+        if (s.retainsize > limit) {
+            s.retainsize = limit;
+        }
+        while (s.retained.size > s.retainsize) {
+            Release(s, s.retained.back);
+        }
+    }
 }
 
-SIZE_T BufferCache::GetNumBlocks() const {
-    return disk->GetNumBlocks();
+void BufferCache::SetDirtyThreshold(const double fraction) {
+    StopWriter();
+    ScopedLock l(&writerlock);
+    dirtythreshold = fraction;
+    if (dirtythreshold > 0 && !pthread_create(&writer, 0, WriterMain, this)) {
+        writerrunning = true;
+    }
 }
 
-double BufferCache::GetCurrentTime() const {
-    return curtime;
+void BufferCache::NotifyComputeTime(const double ms) {
+    ScopedLock l(&disklock);
+    curtime += ms;
 }
 
 ERROR_T BufferCache::NotifyAllocateBlock(const SIZE_T outblocknum) {
+    ScopedLock l(&disklock);
     allocs++;
     return disk->NotifyAllocateBlocks(outblocknum, 1);
 }
 
 ERROR_T BufferCache::NotifyDeallocateBlock(const SIZE_T inblocknum) {
+    ScopedLock l(&disklock);
     deallocs++;
     return disk->NotifyDeallocateBlocks(inblocknum, 1);
 }
 
 
 bool  BufferCache::IsBlockAllocated(const SIZE_T inblocknum) {
+    ScopedLock l(&disklock);
     return disk->IsBlockAllocated(inblocknum);
 }
 
+ERROR_T BufferCache::FindFreeRun(const SIZE_T n, const SIZE_T hint, SIZE_T &first) {
+    ScopedLock l(&disklock);
+    return disk->FindFreeRun(n, hint, first);
+}
 
-ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock) {
-    map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
 
-    b = blockmap.find(inblocknum);
+static bool retained_kind(const BlockKind kind) {
+    return kind == BLOCK_SUPERBLOCK || kind == BLOCK_ROOT || kind == BLOCK_INTERIOR;
+}
 
-    if (b != blockmap.end()) {
-        // It's in  cache, just update its lastaccessed and return it
-        outblock = (*b).second;
-        (*b).second.lastaccessed = curtime;
-        reads++;
-        return ERROR_NOERROR;
+void BufferCache::Retain(BufferShard &s, BufferFrame *f) {
+    s.policy->Remove(f, false);
+    f->retained = true;
+    s.retained.PushFront(f);
+    while (s.retained.size > s.retainsize) {
+        Release(s, s.retained.back);
+    }
+}
+
+void BufferCache::Release(BufferShard &s, BufferFrame *f) {
+    s.retained.Remove(f);
+    f->retained = false;
+    s.policy->Insert(f);
+}
+
+void BufferCache::RecycleRingFrame(BufferShard &s) {
+    // Forget frames that left the ring since they were added
+    for (deque<pair<BufferFrame *, SIZE_T> >::iterator i = s.ring.begin(); i != s.ring.end();) {
+        if (!(*i).first->scanring || (*i).first->blocknum != (*i).second) {
+            i = s.ring.erase(i);
+        } else {
+            ++i;
+        }
+    }
+    if (s.ring.size() < s.ringsize) {
+        // still filling the ring from the cache at large
+        return;
+    }
+    BufferFrame *f = s.ring.front().first;
+    s.ring.pop_front();
+    if (f->IsEvictable() && !f->dirty) {
+        DropFrame(s, f, false);
+        s.ringrecycles++;
+    } else {
+        // Someone is using or has changed it, so it's theirs now
+        f->scanring = false;
+    }
+}
+
+ERROR_T BufferCache::PinFrame(BufferShard &s, const SIZE_T blocknum, const PinMode mode, const AccessHint hint,
+                              BufferFrame *&f) {
+    ERROR_T rc;
+    bool scan = hint == ACCESS_SCAN && s.ringsize > 0 && mode != PIN_OVERWRITE;
+    bool blank = false;     // the frame doesn't hold the block's bytes
+
+    f = FindFrame(s, blocknum);
+
+    if (!f && scan && s.freeframes.empty()) {
+        RecycleRingFrame(s);
+    }
+    while (!f && s.freeframes.empty()) {
+        if ((rc = CheckDeleteOldest(s, blocknum)) != ERROR_NOERROR) {
+            return rc;
+        }
+        // Making room may have let someone else bring it in
+        f = FindFrame(s, blocknum);
+    }
+
+    if (f) {
+        if (f->readahead) {
+            // First use of a readahead block.  A stream rarely comes back,
+            // so it stays first in line until it's used again.
+            f->readahead = false;
+            s.policy->Remove(f, false);
+            s.policy->InsertLowPriority(f);
+            f->lastaccess = ++s.accesscount;
+            s.readaheadhits++;
+        } else if (!scan) {
+            // It's in  cache, just update its recency
+            f->scanring = false;
+            Touch(s, f);
+        }
+        if (f->retained) {
+            s.retainedhits++;
+        }
+        s.hits++;
     } else {
         // It's not in cache, so time to allocate it
-        CheckDeleteOldest();
-        // read it from disk
-        if (!(disk->IsBlockAllocated(inblocknum))) {
-            if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-                cerr << "BufferCache::ReadBlock: Attempt to read unallocated block " << inblocknum << endl;
+        s.misses++;
+        if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS && !IsBlockAllocated(blocknum)) {
+            cerr << "BufferCache::PinBlock: Attempt to access unallocated block " << blocknum << endl;
+        }
+        if (!(f = AddFrame(s, blocknum, scan))) {
+            return ERROR_NOSPACE;
+        }
+        f->lastaccess = ++s.accesscount;
+        if (scan) {
+            f->scanring = true;
+            s.ring.push_back(make_pair(f, blocknum));
+        }
+        if (mode == PIN_OVERWRITE) {
+            // write allocate, but there's no need to fetch what will be replaced
+            memset(f->data, 0, blocksize);
+            blank = true;
+        } else {
+            // Read with the shard unlocked; others wanting the block wait for us
+            f->inflight = true;
+            s.numinflight++;
+            pthread_mutex_unlock(&s.lock);
+            rc = ReadFromDisk(blocknum, f->data);
+            pthread_mutex_lock(&s.lock);
+            f->inflight = false;
+            s.numinflight--;
+            pthread_cond_broadcast(&s.framecond);
+            if (rc != ERROR_NOERROR) {
+                DropFrame(s, f, false);
+                return rc;
             }
         }
-        double reqtime;
-        int rc = disk->Read(inblocknum, outblock, reqtime);
-        curtime += reqtime;
-        diskreads++;
-        if (rc != ERROR_NOERROR) {
+    }
+
+    // Pinned first, so the frame stays put while we wait for the latch
+    f->pincount++;
+    if (mode == PIN_SHARED) {
+        while (f->exclusivelatch) {
+            pthread_cond_wait(&s.framecond, &s.lock);
+        }
+        f->sharedlatches++;
+    } else {
+        while (f->exclusivelatch || f->sharedlatches > 0) {
+            pthread_cond_wait(&s.framecond, &s.lock);
+        }
+        f->exclusivelatch = true;
+        if (elidewrites && !f->dirty && !blank) {
+            // what is on disk, for UnpinBlock to compare against
+            if (s.snapshots.empty()) {
+                f->snapshot = new BYTE_T[blocksize];
+            } else {
+                f->snapshot = s.snapshots.back();
+                s.snapshots.pop_back();
+            }
+            memcpy(f->snapshot, f->data, blocksize);
+        }
+    }
+    return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::PinBlock(const SIZE_T blocknum, BlockHandle &handle, const PinMode mode,
+                              const AccessHint hint) {
+    BufferShard &s = ShardFor(blocknum);
+    BufferFrame *f;
+    ERROR_T rc;
+
+    pthread_mutex_lock(&s.lock);
+    rc = PinFrame(s, blocknum, mode, hint, f);
+    if (rc == ERROR_NOERROR && mode != PIN_OVERWRITE) {
+        s.reads++;
+    }
+    pthread_mutex_unlock(&s.lock);
+
+    if (rc != ERROR_NOERROR) {
+        return rc;
+    }
+    if (reuse && reuse->Sampled(blocknum)) {
+        ScopedLock l(&reuselock);
+        reuse->Access(blocknum, mode != PIN_OVERWRITE);
+    }
+    if (mode != PIN_OVERWRITE && maxreadahead > 0) {
+        // After our own read, so readahead never delays it
+        Readahead(blocknum);
+    }
+    handle.blocknum = blocknum;
+    handle.data = f->data;
+    handle.length = blocksize;
+    handle.frame = f;
+    handle.exclusive = mode != PIN_SHARED;
+    return ERROR_NOERROR;
+}
+
+void BufferCache::NoteBlockKind(const BlockHandle &handle, const BlockKind kind) {
+    BufferShard &s = ShardFor(handle.blocknum);
+    ScopedLock l(&s.lock);
+
+    s.kindaccesses[kind < NUM_BLOCK_KINDS ? kind : BLOCK_OTHER]++;
+    BufferFrame *f = handle.frame;
+    if (!f->retained && retained_kind(kind) && s.retainsize > 0 && !f->scanring) {
+        Retain(s, f);
+    } else if (f->retained && !retained_kind(kind)) {
+        // freed and reused, most likely
+        Release(s, f);
+    }
+}
+
+ERROR_T BufferCache::UnpinBlock(BlockHandle &handle, const bool dirty) {
+    BufferShard &s = ShardFor(handle.blocknum);
+    ScopedLock l(&s.lock);
+    BufferFrame *f = handle.frame;
+
+    if (!f || f->pincount == 0 || (dirty && !handle.exclusive)) {
+        return ERROR_IMPLBUG;
+    }
+    bool changed = dirty;
+    if (handle.exclusive && f->snapshot) {
+        if (dirty && !f->dirty && memcmp(f->snapshot, f->data, blocksize) == 0) {
+            changed = false;
+            s.elidedwrites++;
+        }
+        s.snapshots.push_back(f->snapshot);
+        f->snapshot = 0;
+    }
+    if (handle.exclusive) {
+        f->exclusivelatch = false;
+        pthread_cond_broadcast(&s.framecond);
+    } else if (--f->sharedlatches == 0) {
+        pthread_cond_broadcast(&s.framecond);
+    }
+    f->pincount--;
+    if (dirty) {
+        s.writes++;
+    }
+    if (changed) {
+        SetDirty(f, true);
+        if (reuse && reuse->Sampled(handle.blocknum)) {
+            ScopedLock rl(&reuselock);
+            reuse->Dirty(handle.blocknum);
+        }
+    }
+    handle = BlockHandle();
+    return ERROR_NOERROR;
+}
+
+ERROR_T BufferCache::ReadBlock(const SIZE_T inblocknum, Block &outblock, const AccessHint hint) {
+    BlockHandle h;
+    ERROR_T rc = PinBlock(inblocknum, h, PIN_SHARED, hint);
+
+    if (rc != ERROR_NOERROR) {
+        return rc;
+    }
+    if (outblock.length != h.length || !outblock.data) {
+        if ((rc = outblock.Resize(h.length, false)) != ERROR_NOERROR) {
+            UnpinBlock(h, false);
             return rc;
-        } else {
-            outblock.lastaccessed = curtime;
-            outblock.dirty = false;
-            blockmap[inblocknum] = outblock;
-            reads++;
-            return ERROR_NOERROR;
         }
     }
+    memcpy(outblock.data, h.data, h.length);
+    outblock.dirty = false;
+    return UnpinBlock(h, false);
 }
 
 ERROR_T BufferCache::WriteBlock(const SIZE_T inblocknum, const Block &inblock) {
-    map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
+    BlockHandle h;
+    ERROR_T rc;
 
-    b = blockmap.find(inblocknum);
+    if (inblock.length != GetBlockSize()) {
+        return ERROR_WRONGSIZEBLOCK;
+    }
+    if ((rc = PinBlock(inblocknum, h, PIN_OVERWRITE)) != ERROR_NOERROR) {
+        return rc;
+    }
+    memcpy(h.data, inblock.data, h.length);
+    return UnpinBlock(h, true);
+}
 
-    if (b != blockmap.end()) {
-        // It's in  cache, so just replace the block
-        (*b).second = inblock;
-        (*b).second.lastaccessed = curtime;
-        (*b).second.dirty = true;
-        writes++;
+ERROR_T BufferCache::StartFetch(BufferShard &s, const SIZE_T blocknum, const bool readahead) {
+    if (s.blockmap.find(blocknum) != s.blockmap.end()) {
+        // already cached or on its way
         return ERROR_NOERROR;
-    } else {
-        // It's not in cache, so time to allocate it
-        CheckDeleteOldest();
-        if (!(disk->IsBlockAllocated(inblocknum))) {
-            if (PRINT_BUFFERCACHE_ALLOCATION_ERRORS) {
-                cerr << "BufferCache::WriteBlock: Attempt to write unallocated block " << inblocknum << endl;
-            }
+    }
+    if (blocknum >= disk->GetNumBlocks()) {
+        return ERROR_NOSUCHBLOCK;
+    }
+    if (s.freeframes.empty()) {
+        // Reserve a frame, but never write back on behalf of a prefetch,
+        // since that would block the caller
+        BufferFrame *victim = s.policy->Victim(blocknum);
+        if (!victim || victim->dirty || (readahead && victim->readahead)) {
+            // readahead that is still unused is worth more than more of it
+            return ERROR_NOFETCH;
+        }
+        DropFrame(s, victim, !victim->readahead);
+        s.cleanevictions++;
+        if (s.freeframes.empty()) {
+            // the shard is shrinking and kept the frame
+            return ERROR_NOFETCH;
         }
-        Block myblock = inblock;
-        myblock.lastaccessed = curtime;
-        myblock.dirty = true;
-        blockmap[inblocknum] = myblock;
-        writes++;
-        return ERROR_NOERROR;
     }
+
+    ScopedLock pl(&prefetchlock);
+    if (!prefetcherrunning) {
+        if (pthread_create(&prefetcher, 0, PrefetcherMain, this)) {
+            return ERROR_NOFETCH;
+        }
+        prefetcherrunning = true;
+    }
+
+    BufferFrame *f = AddFrame(s, blocknum, readahead);
+    f->inflight = true;
+    f->prefetched = true;
+    f->readahead = readahead;
+    pthread_mutex_lock(&disklock);
+    f->readytime = curtime;   // issue time until the read completes
+    pthread_mutex_unlock(&disklock);
+    f->lastaccess = s.accesscount;
+    s.numinflight++;
+    if (readahead) {
+        s.readaheads++;
+    } else {
+        s.prefetches++;
+    }
+    prefetchqueue->Add(DiskRequest(blocknum, false, f->readytime, f));
+    pthread_cond_signal(&prefetchcond);
+    return ERROR_NOERROR;
 }
 
 ERROR_T BufferCache::PrefetchBlock(const SIZE_T blocknum) {
-    // Not implemented yet
-    return ERROR_IMPLBUG;
+    BufferShard &s = ShardFor(blocknum);
+    ScopedLock l(&s.lock);
+
+    return StartFetch(s, blocknum, false);
 }
 
 ERROR_T BufferCache::FlushBlock(const SIZE_T blocknum) {
-    map<SIZE_T, Block, cache_compare_lessthan>::iterator b;
+    BufferShard &s = ShardFor(blocknum);
+    ScopedLock l(&s.lock);
+    BufferFrame *f = FindFrame(s, blocknum);
 
-    b = blockmap.find(blocknum);
-
-    if (b == blockmap.end()) {
+    if (!f) {
         return ERROR_NOERROR;
     } else {
-        if ((*b).second.dirty) {
-            double reqtime;
-            int rc;
-            rc = disk->Write((*b).first, (*b).second, reqtime);
-            diskwrites++;
-            curtime += reqtime;
-            if (rc != ERROR_NOERROR) {
-                return rc;
-            }
+        // Don't write out a block while someone is changing it
+        while (f->exclusivelatch) {
+            pthread_cond_wait(&s.framecond, &s.lock);
+        }
+        ERROR_T rc = WriteBack(f);
+        if (rc != ERROR_NOERROR) {
+            return rc;
+        }
+        if (f->pincount == 0) {
+            DropFrame(s, f, false);
         }
-        blockmap.erase(b);
         return ERROR_NOERROR;
     }
 }
 
+ERROR_T BufferCache::FlushRange(const SIZE_T first, const SIZE_T num) {
+    vector <pair<SIZE_T, SIZE_T> > dirty;
+    vector<SIZE_T> blocknums;
+    SIZE_T written;
+
+    for (SIZE_T s = 0; s < numshards; s++) {
+        ScopedLock l(&shards[s].lock);
+        for (unordered_map<SIZE_T, BufferFrame *>::iterator i = shards[s].blockmap.begin(); i != shards[s].blockmap.end(); ++i) {
+            if ((*i).second->dirty && (*i).first >= first && (*i).first - first < num) {
+                dirty.push_back(make_pair((*i).second->dirtyseq, (*i).first));
+            }
+        }
+    }
+    ScheduleWrites(dirty, blocknums);
+    return WriteRuns(blocknums, false, 0, written);
+}
+
+ERROR_T BufferCache::Checkpoint() {
+    ERROR_T rc = FlushRange(0, GetNumBlocks());
+    if (rc != ERROR_NOERROR) {
+        return rc;
+    }
+    return SyncDisk();
+}
+
+
+SIZE_T BufferCache::GetNumReads() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].reads;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumWrites() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].writes;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumHits() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].hits;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumMisses() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].misses;
+    }
+    return n;
+}
+
+double BufferCache::GetHitRatio() const {
+    SIZE_T hits = GetNumHits(), misses = GetNumMisses();
+    return hits + misses > 0 ? (double) hits / (hits + misses) : 0;
+}
+
+SIZE_T BufferCache::GetNumPrefetches() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].prefetches;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumPrefetchHits() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].prefetchhits;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumEvictionWrites() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].evictionwrites;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumCleanEvictions() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].cleanevictions;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumRingRecycles() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].ringrecycles;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumRetainedHits() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].retainedhits;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumElidedWrites() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].elidedwrites;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumAccesses(const BlockKind kind) const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].kindaccesses[kind];
+    }
+    return n;
+}
+
+const char *BufferCache::GetBlockKindName(const BlockKind kind) {
+    switch (kind) {
+        case BLOCK_SUPERBLOCK:
+            return "superblock";
+        case BLOCK_ROOT:
+            return "root";
+        case BLOCK_INTERIOR:
+            return "interior";
+        case BLOCK_LEAF:
+            return "leaf";
+        default:
+            return "other";
+    }
+}
+
+SIZE_T BufferCache::GetNumReadaheads() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].readaheads;
+    }
+    return n;
+}
+
+SIZE_T BufferCache::GetNumReadaheadHits() const {
+    SIZE_T n = 0;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        n += shards[s].readaheadhits;
+    }
+    return n;
+}
+
+double BufferCache::GetReadaheadHitRatio() const {
+    SIZE_T readaheads = GetNumReadaheads();
+    return readaheads > 0 ? (double) GetNumReadaheadHits() / readaheads : 0;
+}
+
 ostream &BufferCache::Print(ostream &os) const {
     os << "BufferCache(cachesize=" << cachesize
     << ", blocksize=" << GetBlockSize()
+    << ", policy=" << GetPolicyName()
+    << ", scheduler=" << GetSchedulerName()
+    << ", shards=" << numshards
+    << ", memorybytes=" << GetMemoryBytes()
+    << ", extents=" << extents.size()
+    << ", mappedbytes=" << GetMappedBytes()
+    << (!extents.empty() && extents[0].hugetlb ? "(hugetlb)" : "")
     << ", curtime=" << curtime
     << ", allocs=" << allocs
     << ", deallocs=" << deallocs
-    << ", reads=" << reads
-    << ", writes=" << writes
+    << ", reads=" << GetNumReads()
+    << ", writes=" << GetNumWrites()
+    << ", hits=" << GetNumHits()
+    << ", misses=" << GetNumMisses()
     << ", diskreads=" << diskreads
+    << ", diskreadrequests=" << diskreadrequests
     << ", diskwrites=" << diskwrites
+    << ", diskwriterequests=" << diskwriterequests
+    << ", prefetches=" << GetNumPrefetches()
+    << ", prefetchhits=" << GetNumPrefetchHits()
+    << ", readaheads=" << GetNumReadaheads()
+    << ", readaheadhits=" << GetNumReadaheadHits()
+    << ", evictionwrites=" << GetNumEvictionWrites()
+    << ", cleanevictions=" << GetNumCleanEvictions()
+    << ", ringrecycles=" << GetNumRingRecycles()
+    << ", retainedhits=" << GetNumRetainedHits()
+    << ", elidedwrites=" << GetNumElidedWrites()
+    << ", warmupblocks=" << warmupblocks
+    << ", backgroundwrites=" << backgroundwrites
+    << ", stalltime=" << stalltime
+    << ", missstalltime=" << missstalltime
+    << ", writebackstalltime=" << writebackstalltime
+    << ", warmuptime=" << warmuptime
     << ", blocks = {";
 
-
-    for (map<SIZE_T, Block, cache_compare_lessthan>::const_iterator b = blockmap.begin();
-         b != blockmap.end();
-         ++b) {
-        if (b != blockmap.begin()) {
+    vector<const BufferFrame *> frames;
+    for (SIZE_T s = 0; s < numshards; s++) {
+        for (unordered_map<SIZE_T, BufferFrame *>::const_iterator i = shards[s].blockmap.begin(); i != shards[s].blockmap.end(); ++i) {
+            frames.push_back((*i).second);
+        }
+    }
+    sort(frames.begin(), frames.end(), frame_blocknum_lessthan);
+    for (SIZE_T i = 0; i < frames.size(); i++) {
+        if (i > 0) {
             os << ", ";
         }
-        os << (*b).first << ((*b).second.dirty ? "(dirty)" : "");
+        os << frames[i]->blocknum << (frames[i]->inflight ? "(inflight)" : frames[i]->dirty ? "(dirty)" : "");
     }
     os << "}, disk=" << *disk << ")";
 
     return os;
 }
-  
+
+// The sizes PrintSizeAdvice reports on, as multiples of the current one
+static const double advice_factors[] = { 0.25, 0.5, 1, 2, 4 };
+#define NUM_ADVICE_FACTORS (sizeof(advice_factors) / sizeof(advice_factors[0]))
+
+ERROR_T BufferCache::PredictForSize(const SIZE_T size, double &preddiskreads, double &predtime) const {
+    if (!reuse) {
+        return ERROR_UNIMPL;
+    }
+    // Only the change LRU predicts is added to what really happened,
+    // which cancels most of the difference between LRU and the policy
+    // in use, and the disk work no cache size avoids
+    double reads = reuse->PredictReads(size) - reuse->PredictReads(numframes);
+    double writes = reuse->PredictWriteBacks(size) - reuse->PredictWriteBacks(numframes);
+    SIZE_T foregroundwrites = diskwrites - backgroundwrites;
+
+    if (reads < -(double) diskreads) {
+        reads = -(double) diskreads;
+    }
+    if (writes < -(double) foregroundwrites) {
+        writes = -(double) foregroundwrites;
+    }
+    preddiskreads = diskreads + reads;
+    // Demand reads are the best sample of what a random access costs;
+    // the run's writes include cheap sequential ones (init, Detach)
+    double cost = 0;
+    if (diskreads > 0) {
+        cost = missstalltime / diskreads;
+    } else if (foregroundwrites > 0) {
+        cost = writebackstalltime / foregroundwrites;
+    }
+    predtime = curtime + (reads + writes) * cost;
+    if (predtime < curtime - stalltime) {
+        predtime = curtime - stalltime;
+    }
+    return ERROR_NOERROR;
+}
+
+ostream &BufferCache::PrintSizeAdvice(ostream &os) const {
+    double preddiskreads, predtime;
+
+    if (!reuse) {
+        return os;
+    }
+    os << "cachesize\tpredicted diskreads\tpredicted time";
+    if (reuse->GetSampleRate() < 1) {
+        os << "\t(sample rate " << reuse->GetSampleRate() << ")";
+    }
+    os << endl;
+    for (SIZE_T i = 0; i < NUM_ADVICE_FACTORS; i++) {
+        SIZE_T size = (SIZE_T) (numframes * advice_factors[i]);
+        if (size < 1) {
+            size = 1;
+        }
+        PredictForSize(size, preddiskreads, predtime);
+        os << size << "\t" << (SIZE_T) (preddiskreads + 0.5) << "\t" << predtime
+           << (advice_factors[i] == 1 ? "\t(current)" : "") << endl;
+    }
+    return os;
+}
+
+ostream &BufferCache::PrintJSON(ostream &os) const {
+    os << "{\n"
+    << "  \"policy\": \"" << GetPolicyName() << "\",\n"
+    << "  \"scheduler\": \"" << GetSchedulerName() << "\",\n"
+    << "  \"cachesize\": " << cachesize << ",\n"
+    << "  \"blocksize\": " << GetBlockSize() << ",\n"
+    << "  \"shards\": " << numshards << ",\n"
+    << "  \"allocs\": " << allocs << ",\n"
+    << "  \"deallocs\": " << deallocs << ",\n"
+    << "  \"reads\": " << GetNumReads() << ",\n"
+    << "  \"writes\": " << GetNumWrites() << ",\n"
+    << "  \"hits\": " << GetNumHits() << ",\n"
+    << "  \"misses\": " << GetNumMisses() << ",\n"
+    << "  \"hitratio\": " << GetHitRatio() << ",\n"
+    << "  \"diskreads\": " << diskreads << ",\n"
+    << "  \"diskreadrequests\": " << diskreadrequests << ",\n"
+    << "  \"diskwrites\": " << diskwrites << ",\n"
+    << "  \"diskwriterequests\": " << diskwriterequests << ",\n"
+    << "  \"prefetches\": " << GetNumPrefetches() << ",\n"
+    << "  \"prefetchhits\": " << GetNumPrefetchHits() << ",\n"
+    << "  \"readaheads\": " << GetNumReadaheads() << ",\n"
+    << "  \"readaheadhits\": " << GetNumReadaheadHits() << ",\n"
+    << "  \"evictions\": {\"clean\": " << GetNumCleanEvictions()
+    << ", \"dirty\": " << GetNumEvictionWrites() << "},\n"
+    << "  \"ringrecycles\": " << GetNumRingRecycles() << ",\n"
+    << "  \"retainedhits\": " << GetNumRetainedHits() << ",\n"
+    << "  \"elidedwrites\": " << GetNumElidedWrites() << ",\n"
+    << "  \"warmupblocks\": " << warmupblocks << ",\n"
+    << "  \"backgroundwrites\": " << backgroundwrites << ",\n"
+    << "  \"time\": {\"total\": " << curtime
+    << ", \"stall\": " << stalltime
+    << ", \"missstall\": " << missstalltime
+    << ", \"writebackstall\": " << writebackstalltime
+    << ", \"warmup\": " << warmuptime << "},\n"
+    << "  \"disk\": {\"throughput\": " << GetDiskThroughput() << ", \"readlatency\": ";
+    readlatency.PrintJSON(os) << ", \"writelatency\": ";
+    writelatency.PrintJSON(os) << "},\n"
+    << "  \"accesses\": {";
+    for (int k = 0; k < NUM_BLOCK_KINDS; k++) {
+        os << (k > 0 ? ", " : "") << "\"" << GetBlockKindName((BlockKind) k) << "\": " << GetNumAccesses((BlockKind) k);
+    }
+    os << "}";
+    if (reuse) {
+        const vector<SIZE_T> &h = reuse->GetHistogram();
+        os << ",\n  \"reusedistance\": {\"samplerate\": " << reuse->GetSampleRate()
+        << ", \"accesses\": " << reuse->GetNumAccesses()
+        << ", \"cold\": " << reuse->GetNumColdAccesses() << ", \"buckets\": [";
+        for (SIZE_T i = 0; i < h.size(); i++) {
+            os << (i > 0 ? ", " : "") << "{\"min\": " << ReuseDistance::BucketLow(i)
+            << ", \"max\": " << ReuseDistance::BucketHigh(i) << ", \"count\": " << h[i] << "}";
+        }
+        os << "]},\n  \"sizeadvice\": [";
+        for (SIZE_T i = 0; i < NUM_ADVICE_FACTORS; i++) {
+            SIZE_T size = (SIZE_T) (numframes * advice_factors[i]);
+            double preddiskreads, predtime;
+            PredictForSize(size > 0 ? size : 1, preddiskreads, predtime);
+            os << (i > 0 ? ", " : "") << "{\"cachesize\": " << (size > 0 ? size : 1)
+            << ", \"diskreads\": " << preddiskreads << ", \"time\": " << predtime << "}";
+        }
+        os << "]";
+    }
+    os << "\n}\n";
+
+    return os;
+}
@@ -2,23 +2,183 @@
 #define _buffercache
 
 #include <iostream>
-#include <map>
+#include <deque>
+#include <utility>
+#include <unordered_map>
+#include <vector>
+#include <pthread.h>
 
 #include "global.h"
 #include "block.h"
 #include "disksystem.h"
+#include "diskscheduler.h"
+#include "replacementpolicy.h"
+#include "reusedistance.h"
 
 using namespace std;
 
-struct cache_compare_lessthan {
-    bool operator()(const SIZE_T s1, const SIZE_T s2) const {
-        return s1 < s2;
-    }
+// How a block is pinned
+enum PinMode {
+    PIN_SHARED,     // read the block; any number of holders
+    PIN_EXCLUSIVE,  // read and change the block; one holder
+    PIN_OVERWRITE   // exclusive, and the whole block will be replaced
+};
+
+
+// How a read is expected to be used
+enum AccessHint {
+    ACCESS_NORMAL,
+    ACCESS_SCAN     // part of a pass over many blocks that won't come back soon
+};
+
+
+// What a block holds, as far as the client tells the cache
+enum BlockKind {
+    BLOCK_OTHER, BLOCK_SUPERBLOCK, BLOCK_ROOT, BLOCK_INTERIOR, BLOCK_LEAF, NUM_BLOCK_KINDS
+};
+
+
+//
+// Direct access to the bytes of a cached block
+// Valid from PinBlock until the matching UnpinBlock
+//
+struct BlockHandle {
+    SIZE_T blocknum;
+    BYTE_T *data;
+    SIZE_T length;
+    BufferFrame *frame;
+    bool exclusive;
+
+    BlockHandle() : blocknum(0), data(0), length(0), frame(0), exclusive(false) { }
 };
 
 
 //
-// LRU block cache with single step prefetch
+// The frames, lookup table and replacement state for the blocks whose
+// numbers map to one shard, behind the shard's own lock
+//
+struct BufferShard {
+    pthread_mutex_t lock;
+    pthread_cond_t framecond;   // a frame finished its I/O or gave up a latch
+    unordered_map <SIZE_T, BufferFrame *> blockmap;
+    vector <BufferFrame *> freeframes;
+    SIZE_T numframes;           // owned, cached or free
+    SIZE_T targetframes;        // what the last Resize asked for
+    ReplacementPolicy *policy;
+    double accesscount;
+    SIZE_T numinflight;         // frames being read or written unlocked
+    SIZE_T reads, writes, hits, misses;
+    SIZE_T prefetches, prefetchhits;
+    SIZE_T evictionwrites;      // dirty victims written on the caller's time
+    SIZE_T cleanevictions;
+    SIZE_T readaheads, readaheadhits;
+    SIZE_T kindaccesses[NUM_BLOCK_KINDS];
+    deque <pair<BufferFrame *, SIZE_T> > ring;  // scan frames, oldest first
+    SIZE_T ringsize;
+    SIZE_T ringrecycles;        // frames a scan reused instead of evicting
+    SIZE_T elidedwrites;        // dirty unpins that left the bytes as they were
+    vector <BYTE_T *> snapshots;    // spare blocks for the frames' snapshots
+    FrameList retained;         // upper level frames, most recent first
+    SIZE_T retainsize;
+    SIZE_T retainedhits;
+
+    BufferShard();
+
+    ~BufferShard();
+};
+
+
+//
+// One mapping of frames.  Attach maps a single extent for the whole
+// cache; a Resize that grows past the spare frames maps another.
+//
+struct FrameExtent {
+    BYTE_T *arena;
+    size_t arenabytes;
+    bool hugetlb;        // arena came from the hugetlb pool
+    BufferFrame *frames;
+    SIZE_T numframes;
+    SIZE_T numspare;     // frames no shard owns
+    bool retiring;       // a shrink is moving blocks out of it
+
+    bool Holds(const BufferFrame *f) const { return f >= frames && f < frames + numframes; }
+};
+
+
+//
+// Reads moving forward through the disk a fixed stride apart
+//
+struct ReadaheadStream {
+    SIZE_T last;    // block most recently read
+    SIZE_T stride;  // 0 until two reads suggest one
+    SIZE_T window;  // how far ahead of last to keep, 0 until confirmed
+    SIZE_T end;     // furthest block already read ahead
+    SIZE_T used;    // when the stream last advanced, for replacement
+};
+
+#define NUM_READAHEAD_STREAMS 8
+
+
+//
+// Block cache with pluggable replacement and asynchronous prefetch
+//
+// Frames live in one arena allocated at Attach and are handed out from a
+// free stack, so a miss never allocates a buffer.  Resize changes the
+// number of frames online: a shard over its new share gives frames back
+// as it evicts, and one under it takes spare frames, mapping more if
+// need be.  A shrink also moves unpinned blocks out of the extents the
+// new size doesn't need, and an extent whose frames have all been given
+// back is unmapped.  Blocks are found through a hash table.  Which
+// block to give up is delegated to a ReplacementPolicy (LRU unless told
+// otherwise); the LRU, CLOCK, 2Q and ARC policies make hits, misses and
+// evictions O(1).
+//
+// The cache can be used by several threads at once.  Block numbers are
+// spread over shards, each with its own lock, table, free frames and
+// policy, so threads working on different shards do not contend.  Disk
+// reads and write-backs run with the shard unlocked; the frame is marked
+// in flight and anyone else who wants it waits for the I/O.  Pinned
+// blocks are latched shared or exclusive.
+//
+// Optionally a background writer keeps the fraction of dirty frames
+// under a threshold, so evictions mostly find clean victims.  It and
+// Detach write in elevator order, sweeping up from the disk head.
+// Runs of contiguous dirty blocks go out as single multi-block writes.
+//
+// With readahead on, reads that follow a stride start fetching the
+// blocks ahead of them, in a window that doubles while the stream keeps
+// going.  Readahead blocks enter at low priority until they are used.
+//
+// Misses hinted ACCESS_SCAN go through a small ring of frames per shard.
+// Once the ring is full, each one reuses the ring's oldest frame, so a
+// full pass over the disk evicts no more than the ring's worth of other
+// blocks.  Scan hits don't count as recent use.
+//
+// A clean block that is written back unchanged stays clean.  Its frame
+// is copied when it is pinned for writing, and the dirty unpin compares
+// the two with memcmp.
+//
+// Superblocks, roots and interior nodes, as told by NoteBlockKind, can
+// be retained: they leave the policy for a per-shard LRU list of a set
+// size, so leaves are evicted before them.  The oldest falls back into
+// the policy when the list overflows, or when nothing else can go.
+//
+// Detach saves the numbers of the cached blocks, most recently used
+// first, in filestem.warmup.  With warm-up on, Attach reads back as many
+// as fit, in disk order and in runs that bridge small gaps, so a new
+// session doesn't start by seeking to the top of the tree at random.
+//
+// Prefetches are read by a background thread into frames reserved
+// up front.  The disk serves one request at a time, so a prefetch
+// occupies the simulated disk from the moment it is issued, and only
+// the part that has not finished when the block is needed is charged
+// to the caller as stall time.
+//
+// Queued prefetches, and each batch of writes the writer thread, a
+// flush or Detach puts together, go to the disk in the order the disk
+// scheduler picks (C-LOOK unless SetScheduler says otherwise).  The
+// prefetcher joins a picked block with queued neighbours above it into
+// one read.
 //
 // Write Back
 // Write Allocate
@@ -26,15 +186,211 @@ class BufferCache {
 private:
     DiskSystem *disk;
     SIZE_T cachesize;
-    map <SIZE_T, Block, cache_compare_lessthan> blockmap;
+    SIZE_T blocksize;
+    bool hugepages;
+    vector <FrameExtent> extents;
+    vector <BufferFrame *> spareframes;   // mapped, but owned by no shard
+    pthread_mutex_t arenalock;            // protects extents and spareframes
+    SIZE_T framebytes;   // blocksize rounded up to a cache line
+    SIZE_T numframes;
+    BufferShard *shards;
+    SIZE_T numshards;
     double curtime;
-    SIZE_T allocs, deallocs, reads, writes, diskreads, diskwrites;
+    double stalltime;
+    double missstalltime;       // the part of stalltime spent reading
+    double writebackstalltime;  // and writing
+    SIZE_T allocs, deallocs, diskreads, diskwrites;
+    SIZE_T diskreadrequests;    // diskreads counts blocks, this counts requests
+    SIZE_T diskwriterequests;   // likewise for diskwrites
+    bool coalesceevictions;
+    bool elidewrites;
+    bool warmup;
+    SIZE_T warmupblocks;
+    double warmuptime;
+    ReuseDistance *reuse;       // null unless tracking is on
+    pthread_mutex_t reuselock;
+
+    pthread_mutex_t disklock;      // protects the disk, the clock, and the disk counts
+    pthread_mutex_t prefetchlock;  // protects the prefetch queue and thread
+    pthread_cond_t prefetchcond;
+    DiskScheduler *prefetchqueue;
+    DiskSchedulerType schedtype;    // under disklock, for batches
+    LatencyHistogram readlatency;   // issue to completion, under disklock
+    LatencyHistogram writelatency;
+    double lastcompletion;          // of any disk request, background ones included
+    bool prefetcherrunning;
+    bool prefetcherstop;
+    pthread_t prefetcher;
+
+    SIZE_T ringframes;      // as last set, for Resize to spread again
+    SIZE_T retainframes;
+
+    SIZE_T maxreadahead;
+    ReadaheadStream streams[NUM_READAHEAD_STREAMS];
+    SIZE_T streamclock;
+    pthread_mutex_t readaheadlock;  // protects the streams
+
+    double dirtythreshold;
+    SIZE_T numdirty;
+    SIZE_T dirtycount;             // frames made dirty, numbering them in order
+    SIZE_T backgroundwrites;
+    pthread_mutex_t writerlock;    // protects numdirty and the writer thread
+    pthread_cond_t writercond;
+    bool writerrunning;
+    bool writerstop;
+    pthread_t writer;
+
+    static void *PrefetcherMain(void *cache);
+
+    void PrefetcherLoop();
+
+    void StopPrefetcher();
+
+    static void *WriterMain(void *cache);
+
+    void WriterLoop();
+
+    void StopWriter();
+
+    // Writes dirty frames in elevator order until at most target are left
+    // returns how many it wrote
+    SIZE_T CleanFrames(const SIZE_T target);
+
 protected:
-    ERROR_T CheckDeleteOldest();
+    ERROR_T AllocateArena();
+
+    void FreeArena();
+
+    // These require arenalock
+
+    // Maps n frames into the spare pool
+    ERROR_T AllocateExtent(const SIZE_T n);
+
+    void FreeExtent(const SIZE_T i);
+
+    FrameExtent *ExtentOf(const BufferFrame *f);
+
+    // Returns a frame to the pool, unmapping its extent once all spare
+    void AddSpare(BufferFrame *f);
+
+    // Takes a spare frame from an extent that is not retiring, or null
+    BufferFrame *TakeSpare();
+
+    BufferShard &ShardFor(const SIZE_T blocknum) const { return shards[blocknum % numshards]; }
+
+    // Locks every shard and waits out their I/O, for whole-cache operations
+    void LockAllShards();
+
+    void UnlockAllShards();
+
+    // These need every shard locked
+
+    // The list is only a hint, so a missing or stale one is ignored
+    ERROR_T LoadWarmupList();
+
+    ERROR_T SaveWarmupList();
+
+    // The rest require the shard's lock
+
+    // Takes a frame off the free stack, or returns null
+    BufferFrame *AddFrame(BufferShard &s, const SIZE_T blocknum, const bool lowpriority = false);
+
+    void Touch(BufferShard &s, BufferFrame *f);
+
+    BufferFrame *FindFrame(BufferShard &s, const SIZE_T blocknum);
+
+    void WaitForFetches(BufferShard &s);
+
+    void DropFrame(BufferShard &s, BufferFrame *f, const bool evicted);
+
+    // Puts a frame that holds nothing on the free stack, or gives it up
+    // if the shard is over its share
+    void FreeFrame(BufferShard &s, BufferFrame *f);
+
+    void DropAllFrames(BufferShard &s);
+
+    // Moves an evictable block from one frame to another that holds
+    // nothing, leaving from empty
+    void MoveFrame(BufferShard &s, BufferFrame *from, BufferFrame *to);
+
+    // Moves blocks out of retiring extents, so that those can be unmapped
+    void CompactShard(BufferShard &s);
+
+    // Evicts until there is a free frame for incoming
+    // ERROR_NOSPACE means every frame is pinned
+    ERROR_T CheckDeleteOldest(BufferShard &s, const SIZE_T incoming);
+
+    void SetDirty(BufferFrame *f, const bool dirty);
+
+    // Takes a shared latch on blocknum's frame so it can be written out,
+    // if it is dirty and nobody is changing it; otherwise returns null
+    BufferFrame *LatchForWrite(BufferShard &s, const SIZE_T blocknum);
+
+    // Adds the dirty neighbours of victim, which is in flight, to either
+    // side of it in run, latching them.  Other shards are only tried.
+    void GatherDirtyNeighbours(BufferShard &s, BufferFrame *victim, vector<BufferFrame *> &run);
+
+    // Writes f out if it is dirty, keeping the lock
+    ERROR_T WriteBack(BufferFrame *f);
+
+    ERROR_T PinFrame(BufferShard &s, const SIZE_T blocknum, const PinMode mode, const AccessHint hint,
+                     BufferFrame *&f);
+
+    // Moves f between the policy and the retained list
+    void Retain(BufferShard &s, BufferFrame *f);
+
+    void Release(BufferShard &s, BufferFrame *f);
+
+    // Frees the oldest frame of a full scan ring if it can be reused
+    void RecycleRingFrame(BufferShard &s);
+
+    // Queues a read of blocknum for the prefetcher, for PrefetchBlock
+    // or for readahead
+    ERROR_T StartFetch(BufferShard &s, const SIZE_T blocknum, const bool readahead);
+
+    // These take disklock themselves
+
+    // Also counts the request's latency
+    double ScheduleDiskRequest(const SIZE_T blocknum, const SIZE_T num, const double issuetime, const double reqtime,
+                               const bool write);
+
+    ERROR_T ReadFromDisk(const SIZE_T blocknum, BYTE_T *data);
+
+    // The caller must keep the data from changing.  A background write
+    // occupies the disk but does not advance the clock.
+    ERROR_T WriteToDisk(const SIZE_T blocknum, BYTE_T *data, const bool background);
+
+    // run holds frames for contiguous blocks, written as one request
+    ERROR_T WriteRunToDisk(const vector<BufferFrame *> &run, const bool background);
+
+    // Makes what has been written reach the disk's file; takes no
+    // simulated time
+    ERROR_T SyncDisk();
+
+    // Marks the frames of a written run clean, unless rc says it failed,
+    // and drops the latches LatchForWrite took
+    void ReleaseRun(const vector<BufferFrame *> &run, const ERROR_T rc);
+
+    // Writes the dirty blocks out of blocknums, in the order given, as
+    // runs.  Stops before a run once no more than target blocks are dirty.
+    ERROR_T WriteRuns(const vector<SIZE_T> &blocknums, const bool background, const SIZE_T target, SIZE_T &written);
+
+    // Feeds a read to the stream detector, reading ahead if it continues
+    // a stream.  Takes the locks it needs.
+    void Readahead(const SIZE_T blocknum);
+
+    // Puts a batch of block writes in the order the scheduler would
+    // serve them from the head.  dirty holds (dirtyseq, blocknum) of
+    // each, so they arrive in the order they became dirty.
+    void ScheduleWrites(vector <pair<SIZE_T, SIZE_T> > &dirty, vector<SIZE_T> &blocknums);
 
 public:
     // Cache size is in number of blocks
-    BufferCache(DiskSystem *disk, const SIZE_T cachesize);
+    // hugepages asks for the frame arena to be backed by huge pages
+    // numshards is clamped to the cache size
+    BufferCache(DiskSystem *disk, const SIZE_T cachesize,
+                const ReplacementPolicyType policy = REPLACEMENT_LRU, const bool hugepages = false,
+                const SIZE_T numshards = 1);
 
     BufferCache() { throw 0; }
 
@@ -49,6 +405,7 @@ public:
 
     // Call Attach before your first read or write
     // Call Detach after your last read or write
+    // Attach (re)allocates the frame arena
     ERROR_T Attach();
 
     ERROR_T Detach();
@@ -56,6 +413,31 @@ public:
     // Number of blocks in the cache
     SIZE_T GetCacheSize() const;
 
+    // Memory one frame takes: its block rounded up to a cache line, the
+    // frame, its node and bucket in the lookup table, and its slot on
+    // the free stack
+    static size_t GetFrameBytes(const SIZE_T blocksize);
+
+    // How many frames budget bytes pay for, at least one
+    static SIZE_T GetFramesForBudget(const size_t budget, const SIZE_T blocksize);
+
+    size_t GetMemoryBytes() const { return (size_t) numframes * GetFrameBytes(GetBlockSize()); }
+
+    // Block memory actually mapped, which a shrink only gives back a
+    // whole extent at a time
+    size_t GetMappedBytes() const;
+
+    // Grows or shrinks the cache, while it is in use, to the frames
+    // budget bytes pay for (at least one per shard).  Shrinking evicts
+    // now, writing dirty blocks back; pinned frames leave once they are
+    // unpinned and evicted.  Not to be called from two threads at once.
+    ERROR_T Resize(const size_t budget);
+
+    SIZE_T GetNumShards() const { return numshards; }
+
+    // lru, clock, 2q, arc, or lru2
+    const char *GetPolicyName() const;
+
     // Number of bytes per block
     SIZE_T GetBlockSize() const;
 
@@ -65,6 +447,46 @@ public:
     // Current time in the simulation (starts at zero)
     double GetCurrentTime() const;
 
+    // Read up to maxwindow blocks ahead of sequential or strided reads
+    // 0 (the default) turns readahead off
+    void SetReadahead(const SIZE_T maxwindow);
+
+    // Keep the reuse distance histogram of pinned blocks, of all of
+    // them or of a hashed sample (see ReuseDistance)
+    void SetTrackReuse(const bool track, const double samplerate = 1);
+
+    // Frames set aside for ACCESS_SCAN misses, spread over the shards
+    // 0 turns the ring off, so scans are cached like any other read
+    void SetScanRing(const SIZE_T frames);
+
+    // Have Attach read in the blocks the last Detach left cached
+    void SetWarmup(const bool warm) { warmup = warm; }
+
+    // Frames, spread over the shards, for keeping upper level blocks
+    // ahead of leaves; at most three quarters of each shard.  0 (the
+    // default) leaves every block to the policy.
+    void SetRetention(const SIZE_T frames);
+
+    // Keep blocks clean when a write leaves their bytes unchanged (the default)
+    void SetElideWrites(const bool elide) { elidewrites = elide; }
+
+    // Also write out the dirty neighbours of a dirty victim, in one request
+    void SetCoalesceEvictions(const bool coalesce) { coalesceevictions = coalesce; }
+
+    // Start writing dirty blocks in the background whenever more than
+    // fraction of the frames are dirty, down to half that.  0 turns it off.
+    void SetDirtyThreshold(const double fraction);
+
+    // How queued prefetches and batches of writes are ordered
+    void SetScheduler(const DiskSchedulerType type);
+
+    // fifo, sstf, scan, clook, or deadline
+    const char *GetSchedulerName() const;
+
+    // Tell the cache that the client spent ms milliseconds computing.
+    // Outstanding prefetches proceed in the meantime.
+    void NotifyComputeTime(const double ms);
+
     // outblocknum is the number of the block that we just allocated
     // if the error return is nonzero
     ERROR_T NotifyAllocateBlock(const SIZE_T outblocknum);
@@ -75,9 +497,31 @@ public:
     // check to see if we think the block was allocated
     bool IsBlockAllocated(const SIZE_T inblocknum);
 
+    // n contiguous free blocks on the disk, the first run at or after hint
+    // returns ERROR_NOERROR or ERROR_NOSPACE
+    ERROR_T FindFreeRun(const SIZE_T n, const SIZE_T hint, SIZE_T &first);
+
+    // Pins the block in the cache and points handle at its bytes.
+    // A pinned block is never evicted.  The pin waits for any latch
+    // that conflicts with mode; PIN_OVERWRITE skips reading on a miss.
     // returns one of ERROR_NOERROR  (zero)
     // ERROR_NOSUCHBLOCK or other nonzero error codes
-    ERROR_T ReadBlock(const SIZE_T inblocknum, Block &outblock);
+    ERROR_T PinBlock(const SIZE_T blocknum, BlockHandle &handle, const PinMode mode = PIN_SHARED,
+                     const AccessHint hint = ACCESS_NORMAL);
+
+    // Counts an access to a pinned block of the given kind, and retains
+    // it if it is an upper level one
+    void NoteBlockKind(const BlockHandle &handle, const BlockKind kind);
+
+    // Releases a pin; dirty means the bytes were changed through the handle,
+    // which needs an exclusive pin
+    ERROR_T UnpinBlock(BlockHandle &handle, const bool dirty);
+
+    // Copying interfaces, built on PinBlock and UnpinBlock
+
+    // returns one of ERROR_NOERROR  (zero)
+    // ERROR_NOSUCHBLOCK or other nonzero error codes
+    ERROR_T ReadBlock(const SIZE_T inblocknum, Block &outblock, const AccessHint hint = ACCESS_NORMAL);
 
     // returns one of ERROR_NOERROR  (zero)
     // ERROR_NOSUCHBLOCK
@@ -88,27 +532,123 @@ public:
     // This returns immediately.
     // ERROR_NOFETCH means that there is no room currently
     // to prefetch the block and it was not prefetched.
+    // A later ReadBlock of the same block waits for the fetch
+    // rather than issuing a second read.
     ERROR_T PrefetchBlock(const SIZE_T blocknum);
 
     // Request that a block be flushed to disk
     // Note that this blocks until the block is finished.
+    // The block leaves the cache unless it is pinned.
     ERROR_T FlushBlock(const SIZE_T blocknum);
 
+    // Writes the dirty blocks in [first, first + num), coalescing
+    // contiguous ones, and keeps them cached.  Blocks pinned exclusive
+    // at the time are left dirty.
+    ERROR_T FlushRange(const SIZE_T first, const SIZE_T num);
+
+    // FlushRange over the whole disk.  This and Detach also sync the
+    // disk's file.
+    ERROR_T Checkpoint();
+
 
     SIZE_T GetNumAllocs() const { return allocs; }
 
     SIZE_T GetNumDeallocs() const { return deallocs; }
 
-    SIZE_T GetNumReads() const { return reads; }
+    SIZE_T GetNumReads() const;
 
-    SIZE_T GetNumWrites() const { return writes; }
+    SIZE_T GetNumWrites() const;
 
     SIZE_T GetNumDiskReads() const { return diskreads; }
 
     SIZE_T GetNumDiskWrites() const { return diskwrites; }
 
+    SIZE_T GetNumDiskReadRequests() const { return diskreadrequests; }
+
+    SIZE_T GetNumDiskWriteRequests() const { return diskwriterequests; }
+
+    // Reads and writes that found / did not find their block in the cache
+    SIZE_T GetNumHits() const;
+
+    SIZE_T GetNumMisses() const;
+
+    double GetHitRatio() const;
+
+    SIZE_T GetNumPrefetches() const;
+
+    SIZE_T GetNumPrefetchHits() const;
+
+    // Blocks read ahead, and how many of them were then used
+    SIZE_T GetNumReadaheads() const;
+
+    SIZE_T GetNumReadaheadHits() const;
+
+    double GetReadaheadHitRatio() const;
+
+    // Dirty evictions, which the reader or writer had to wait for
+    SIZE_T GetNumEvictionWrites() const;
+
+    SIZE_T GetNumCleanEvictions() const;
+
+    // Scan misses that reused a ring frame
+    SIZE_T GetNumRingRecycles() const;
+
+    // Hits on retained frames
+    SIZE_T GetNumRetainedHits() const;
+
+    // Writes that did not dirty their block, since nothing changed
+    SIZE_T GetNumElidedWrites() const;
+
+    SIZE_T GetNumBackgroundWrites() const { return backgroundwrites; }
+
+    // Disk requests per second of simulated time, up to when the last
+    // one finished
+    double GetDiskThroughput() const;
+
+    // Simulated time from issuing each disk request until it finished,
+    // time spent queued in the cache included
+    const LatencyHistogram &GetReadLatency() const { return readlatency; }
+
+    const LatencyHistogram &GetWriteLatency() const { return writelatency; }
+
+    // Simulated time the client spent waiting on the disk
+    double GetStallTime() const { return stalltime; }
+
+    // Split into waiting for reads (demand misses and late prefetches)
+    // and for writes (dirty victims, flushes)
+    double GetMissStallTime() const { return missstalltime; }
+
+    double GetWriteBackStallTime() const { return writebackstalltime; }
+
+    // Blocks Attach read in for warm-up, and the part of the miss stall
+    // time it took
+    SIZE_T GetNumWarmupBlocks() const { return warmupblocks; }
+
+    double GetWarmupTime() const { return warmuptime; }
+
+    // As noted through NoteBlockKind
+    SIZE_T GetNumAccesses(const BlockKind kind) const;
+
+    static const char *GetBlockKindName(const BlockKind kind);
+
+    // Null unless SetTrackReuse is on
+    const ReuseDistance *GetReuseDistance() const { return reuse; }
+
+    // Disk reads and simulated time this run would have taken with a
+    // cache of size blocks, from the reuse distances.  Each extra read or
+    // dirty eviction LRU would have taken costs what a demand read did
+    // on average.
+    // ERROR_UNIMPL unless SetTrackReuse is on.
+    ERROR_T PredictForSize(const SIZE_T size, double &diskreads, double &time) const;
+
+    // Predictions at 1/4, 1/2, 2 and 4 times the current size
+    ostream &PrintSizeAdvice(ostream &os) const;
+
     ostream &Print(ostream &os) const;
 
+    // All of the above as one JSON object
+    ostream &PrintJSON(ostream &os) const;
+
 };
 
 
@@ -0,0 +1,105 @@
+#include <string>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <memory>
+
+#include "buffercache.h"
+
+
+void usage() {
+    cerr << "usage: cachebench filestem maxcachesize [nummisses] [-hugepages] [-backend name]\n";
+    cerr << "  measures the wall-clock cost of a buffer cache miss (including its eviction)\n";
+    cerr << "  for cache sizes 64, 256, ..., maxcachesize.  The disk needs at least\n";
+    cerr << "  2*maxcachesize blocks.  -hugepages backs the frame arena with huge pages.\n";
+    cerr << "  -backend picks how the disk's data file is read: stdio (default), mmap,\n";
+    cerr << "  pread, or direct (pread with O_DIRECT, bypassing the page cache).\n";
+}
+
+static double now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage();
+        exit(-1);
+    }
+    SIZE_T maxcachesize = atoi(argv[2]);
+    SIZE_T nummisses = 10000;
+    bool hugepages = false;
+    DiskBackend backend = DISK_STDIO;
+
+    for (int i = 3; i < argc; i++) {
+        if (string(argv[i]) == "-hugepages") {
+            hugepages = true;
+        } else if (string(argv[i]) == "-backend" && i + 1 < argc) {
+            if (DiskSystem::ParseBackend(argv[++i], backend) != ERROR_NOERROR) {
+                usage();
+                exit(-1);
+            }
+        } else {
+            nummisses = atoi(argv[i]);
+        }
+    }
+
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(argv[1]));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
+    ERROR_T rc;
+
+    if ((rc = disk.SetBackend(backend)) != ERROR_NOERROR) {
+        cerr << "Can't set up the disk backend due to error " << rc << endl;
+        return -1;
+    }
+
+    if (disk.GetNumBlocks() < 2 * maxcachesize) {
+        cerr << "Disk has only " << disk.GetNumBlocks() << " blocks, need " << 2 * maxcachesize << endl;
+        return -1;
+    }
+
+    cerr << "cachesize\tus/miss\tsimtime/miss\n";
+
+    for (SIZE_T cachesize = 64; cachesize <= maxcachesize; cachesize *= 4) {
+        BufferCache cache(&disk, cachesize, REPLACEMENT_LRU, hugepages);
+        Block block;
+
+        cache.Attach();
+
+        // Fill the cache
+        for (SIZE_T i = 0; i < cachesize; i++) {
+            if ((rc = cache.ReadBlock(i, block)) != ERROR_NOERROR) {
+                cerr << "Error " << rc << " occured when reading block " << i << endl;
+                return -1;
+            }
+        }
+
+        // A cyclic sweep over 2*cachesize blocks misses on every access under LRU
+        SIZE_T diskreads = cache.GetNumDiskReads();
+        double simstart = cache.GetCurrentTime();
+        double start = now_us();
+        for (SIZE_T i = 0; i < nummisses; i++) {
+            SIZE_T b = (cachesize + i) % (2 * cachesize);
+            if ((rc = cache.ReadBlock(b, block)) != ERROR_NOERROR) {
+                cerr << "Error " << rc << " occured when reading block " << b << endl;
+                return -1;
+            }
+        }
+        double elapsed = now_us() - start;
+
+        if (cache.GetNumDiskReads() - diskreads != nummisses) {
+            cerr << "Expected " << nummisses << " misses, got " << (cache.GetNumDiskReads() - diskreads) << endl;
+        }
+
+        cerr << cachesize << "\t" << elapsed / nummisses
+        << "\t" << (cache.GetCurrentTime() - simstart) / nummisses << endl;
+
+        cache.Detach();
+    }
+
+    return 0;
+}
@@ -0,0 +1,206 @@
+#include <math.h>
+#include <iterator>
+
+#include "diskscheduler.h"
+
+// Latencies up to this many milliseconds share the first bucket
+const double LATENCY_BASE = 0.001;
+// and there are this many buckets to each doubling after it
+const double LATENCY_STEPS = 8;
+
+
+DiskScheduler *DiskScheduler::Create(const DiskSchedulerType type) {
+    switch (type) {
+        case DISKSCHED_FIFO:
+            return new FIFOScheduler();
+        case DISKSCHED_SSTF:
+            return new SSTFScheduler();
+        case DISKSCHED_SCAN:
+            return new SCANScheduler();
+        case DISKSCHED_DEADLINE:
+            return new DeadlineScheduler();
+        case DISKSCHED_CLOOK:
+        default:
+            return new CLOOKScheduler();
+    }
+}
+
+ERROR_T DiskScheduler::ParseType(const string &name, DiskSchedulerType &type) {
+    if (name == "fifo") {
+        type = DISKSCHED_FIFO;
+    } else if (name == "sstf") {
+        type = DISKSCHED_SSTF;
+    } else if (name == "scan") {
+        type = DISKSCHED_SCAN;
+    } else if (name == "clook") {
+        type = DISKSCHED_CLOOK;
+    } else if (name == "deadline") {
+        type = DISKSCHED_DEADLINE;
+    } else {
+        return ERROR_BADCONFIG;
+    }
+    return ERROR_NOERROR;
+}
+
+void DiskScheduler::Add(const DiskRequest &r) {
+    BlockQueue::iterator i = byblock.insert(make_pair(make_pair(r.blocknum, nextseq), r)).first;
+    byarrival[r.write][nextseq] = i;
+    nextseq++;
+}
+
+DiskRequest DiskScheduler::Remove(const BlockQueue::iterator i) {
+    DiskRequest r = (*i).second;
+    byarrival[r.write].erase((*i).first.second);
+    byblock.erase(i);
+    return r;
+}
+
+DiskScheduler::BlockQueue::iterator DiskScheduler::Oldest() {
+    if (byarrival[0].empty()) {
+        return (*byarrival[1].begin()).second;
+    } else if (byarrival[1].empty() || (*byarrival[0].begin()).first < (*byarrival[1].begin()).first) {
+        return (*byarrival[0].begin()).second;
+    } else {
+        return (*byarrival[1].begin()).second;
+    }
+}
+
+DiskScheduler::BlockQueue::iterator DiskScheduler::CircularNext(const SIZE_T head) {
+    BlockQueue::iterator i = byblock.lower_bound(make_pair(head, 0ULL));
+    return i != byblock.end() ? i : byblock.begin();
+}
+
+DiskRequest DiskScheduler::Next(const SIZE_T head, const double now) {
+    BlockQueue::iterator i = Pick(head, now), below;
+
+    // Queued neighbours are one request to the disk, read upward from
+    // the lowest, however the sweep came to them
+    while (i != byblock.begin() && (*(below = prev(i))).first.first + 1 == (*i).first.first) {
+        i = below;
+    }
+    return Remove(i);
+}
+
+bool DiskScheduler::Take(const SIZE_T blocknum, DiskRequest &r) {
+    BlockQueue::iterator i = byblock.lower_bound(make_pair(blocknum, 0ULL));
+
+    if (i == byblock.end() || (*i).first.first != blocknum) {
+        return false;
+    }
+    r = Remove(i);
+    return true;
+}
+
+void DiskScheduler::MoveTo(DiskScheduler &other) {
+    while (!IsEmpty()) {
+        other.Add(Remove(Oldest()));
+    }
+}
+
+void DiskScheduler::Order(vector<SIZE_T> &blocknums, const bool write, SIZE_T head, const double now) {
+    for (SIZE_T i = 0; i < blocknums.size(); i++) {
+        Add(DiskRequest(blocknums[i], write, now));
+    }
+    for (SIZE_T i = 0; i < blocknums.size();) {
+        DiskRequest r = Next(head, now);
+        do {
+            blocknums[i++] = r.blocknum;
+        } while (Take(r.blocknum + 1, r));
+        head = blocknums[i - 1];
+    }
+}
+
+
+DiskScheduler::BlockQueue::iterator FIFOScheduler::Pick(const SIZE_T head, const double now) {
+    return Oldest();
+}
+
+
+DiskScheduler::BlockQueue::iterator SSTFScheduler::Pick(const SIZE_T head, const double now) {
+    BlockQueue::iterator above = byblock.lower_bound(make_pair(head, 0ULL));
+
+    if (above == byblock.begin()) {
+        return above;
+    }
+    BlockQueue::iterator below = above;
+    --below;
+    // Ties go up, so a run is served in order
+    if (above != byblock.end() && (*above).first.first - head <= head - (*below).first.first) {
+        return above;
+    }
+    return below;
+}
+
+
+DiskScheduler::BlockQueue::iterator SCANScheduler::Pick(const SIZE_T head, const double now) {
+    if (up) {
+        BlockQueue::iterator i = byblock.lower_bound(make_pair(head, 0ULL));
+        if (i != byblock.end()) {
+            return i;
+        }
+        up = false;
+    }
+    // The last request at or below head
+    BlockQueue::iterator i = byblock.lower_bound(make_pair(head + 1, 0ULL));
+    if (i != byblock.begin()) {
+        return --i;
+    }
+    up = true;
+    return i;
+}
+
+
+DiskScheduler::BlockQueue::iterator CLOOKScheduler::Pick(const SIZE_T head, const double now) {
+    return CircularNext(head);
+}
+
+
+DiskScheduler::BlockQueue::iterator DeadlineScheduler::Pick(const SIZE_T head, const double now) {
+    for (int write = 0; write < 2; write++) {
+        if (!byarrival[write].empty()) {
+            BlockQueue::iterator i = (*byarrival[write].begin()).second;
+            if ((*i).second.issuetime + (write ? DEADLINE_WRITE_EXPIRE : DEADLINE_READ_EXPIRE) <= now) {
+                return i;
+            }
+        }
+    }
+    return CircularNext(head);
+}
+
+
+void LatencyHistogram::Add(const double ms) {
+    SIZE_T k = ms > LATENCY_BASE ? (SIZE_T) ceil(LATENCY_STEPS * log2(ms / LATENCY_BASE)) : 0;
+
+    if (k >= buckets.size()) {
+        buckets.resize(k + 1, 0);
+    }
+    buckets[k]++;
+    count++;
+    total += ms;
+    if (ms > max) {
+        max = ms;
+    }
+}
+
+double LatencyHistogram::GetPercentile(const double p) const {
+    SIZE_T want = (SIZE_T) ceil(p * count), seen = 0;
+
+    for (SIZE_T k = 0; k < buckets.size(); k++) {
+        seen += buckets[k];
+        if (seen >= want && seen > 0) {
+            double end = LATENCY_BASE * pow(2, k / LATENCY_STEPS);
+            return end < max ? end : max;
+        }
+    }
+    return max;
+}
+
+ostream &LatencyHistogram::PrintJSON(ostream &os) const {
+    os << "{\"count\": " << count
+    << ", \"mean\": " << GetMean()
+    << ", \"p50\": " << GetPercentile(0.5)
+    << ", \"p95\": " << GetPercentile(0.95)
+    << ", \"p99\": " << GetPercentile(0.99)
+    << ", \"max\": " << max << "}";
+    return os;
+}
@@ -0,0 +1,186 @@
+#ifndef _diskscheduler
+#define _diskscheduler
+
+#include <iostream>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "global.h"
+
+using namespace std;
+
+struct BufferFrame;
+
+// Simulated milliseconds a request may wait under the deadline
+// scheduler before it is served ahead of the sweep
+const double DEADLINE_READ_EXPIRE = 50;
+const double DEADLINE_WRITE_EXPIRE = 500;
+
+
+struct DiskRequest {
+    SIZE_T blocknum;
+    bool write;
+    double issuetime;       // simulated time it was queued
+    BufferFrame *frame;     // the frame it fills, for the cache's prefetches
+
+    DiskRequest(const SIZE_T blocknum = 0, const bool write = false, const double issuetime = 0,
+                BufferFrame *frame = 0) : blocknum(blocknum), write(write), issuetime(issuetime), frame(frame) { }
+};
+
+
+enum DiskSchedulerType {
+    DISKSCHED_FIFO, DISKSCHED_SSTF, DISKSCHED_SCAN, DISKSCHED_CLOOK, DISKSCHED_DEADLINE
+};
+
+
+//
+// Holds single block requests that are waiting for the disk and picks
+// which goes next, given the block the head is on and the clock
+//
+// The head position is a block number, so distance along the disk
+// stands in for the seek and rotation ModelAccess charges.
+//
+class DiskScheduler {
+protected:
+    typedef map<pair<SIZE_T, unsigned long long>, DiskRequest> BlockQueue;
+
+    BlockQueue byblock;     // by block, then arrival
+    map<unsigned long long, BlockQueue::iterator> byarrival[2];    // reads and writes, oldest first
+    unsigned long long nextseq;
+
+    virtual BlockQueue::iterator Pick(const SIZE_T head, const double now) = 0;
+
+    // The oldest of the reads and writes
+    BlockQueue::iterator Oldest();
+
+    // The first request at or past head, wrapping around to the lowest
+    BlockQueue::iterator CircularNext(const SIZE_T head);
+
+    DiskRequest Remove(const BlockQueue::iterator i);
+
+public:
+    DiskScheduler() : nextseq(0) { }
+
+    virtual ~DiskScheduler() { }
+
+    static DiskScheduler *Create(const DiskSchedulerType type);
+
+    // Accepts fifo, sstf, scan, clook, and deadline
+    // returns ERROR_NOERROR or ERROR_BADCONFIG
+    static ERROR_T ParseType(const string &name, DiskSchedulerType &type);
+
+    void Add(const DiskRequest &r);
+
+    bool IsEmpty() const { return byblock.empty(); }
+
+    SIZE_T GetSize() const { return byblock.size(); }
+
+    // Removes and returns the request to serve next; there must be one.
+    // That is the lowest of the run of queued neighbours the scheduler's
+    // pick belongs to, and Take should get the rest.
+    DiskRequest Next(const SIZE_T head, const double now);
+
+    // Removes the oldest request for blocknum, if there is one, so it can
+    // join a run with its neighbour
+    bool Take(const SIZE_T blocknum, DiskRequest &r);
+
+    // Hands every request to other, in the order they arrived
+    void MoveTo(DiskScheduler &other);
+
+    // Puts a batch of requests, all issued now in the order given, in
+    // the order they would be served from head.  Needs an empty queue.
+    void Order(vector<SIZE_T> &blocknums, const bool write, SIZE_T head, const double now);
+
+    virtual const char *GetName() const = 0;
+};
+
+
+// Arrival order
+class FIFOScheduler : public DiskScheduler {
+protected:
+    BlockQueue::iterator Pick(const SIZE_T head, const double now);
+
+public:
+    const char *GetName() const { return "fifo"; }
+};
+
+
+// Shortest seek first: the nearest request on either side
+class SSTFScheduler : public DiskScheduler {
+protected:
+    BlockQueue::iterator Pick(const SIZE_T head, const double now);
+
+public:
+    const char *GetName() const { return "sstf"; }
+};
+
+
+// The elevator, sweeping up and then down as far as there are requests (LOOK)
+class SCANScheduler : public DiskScheduler {
+private:
+    bool up;
+
+protected:
+    BlockQueue::iterator Pick(const SIZE_T head, const double now);
+
+public:
+    SCANScheduler() : up(true) { }
+
+    const char *GetName() const { return "scan"; }
+};
+
+
+// Upward sweeps only, jumping back to the lowest request at the top
+class CLOOKScheduler : public DiskScheduler {
+protected:
+    BlockQueue::iterator Pick(const SIZE_T head, const double now);
+
+public:
+    const char *GetName() const { return "clook"; }
+};
+
+
+// C-LOOK, except that a request that has waited past its expiry goes
+// first, the oldest read before the oldest write
+class DeadlineScheduler : public DiskScheduler {
+protected:
+    BlockQueue::iterator Pick(const SIZE_T head, const double now);
+
+public:
+    const char *GetName() const { return "deadline"; }
+};
+
+
+//
+// Distribution of request latencies, in simulated milliseconds, for
+// percentiles.  Bucket k > 0 ends at LATENCY_BASE * 2^(k/8), so a
+// percentile is within about 9% of the true one.
+//
+class LatencyHistogram {
+private:
+    vector <SIZE_T> buckets;
+    SIZE_T count;
+    double total;
+    double max;
+
+public:
+    LatencyHistogram() : count(0), total(0), max(0) { }
+
+    void Add(const double ms);
+
+    SIZE_T GetCount() const { return count; }
+
+    double GetMean() const { return count > 0 ? total / count : 0; }
+
+    double GetMax() const { return max; }
+
+    // The latency fraction p (0 to 1) of the requests took at most
+    double GetPercentile(const double p) const;
+
+    // As a JSON object of the mean, p50, p95, p99 and max
+    ostream &PrintJSON(ostream &os) const;
+};
+
+#endif
@@ -1,14 +1,35 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <limits.h>
 
 #include <string.h>
 #include <stdio.h>
 
 #include <math.h>
 
+#include <algorithm>
+
 #include "disksystem.h"
 
+// Names the layout of a striped disk
+const char *STRIPES_SUFFIX = ".stripes";
+
+// Starts the part of a config file that describes a flash device
+const char *MODEL_HEADER = "# model\n";
+
+// The bitmap file is written back a page at a time, so a Sync costs
+// the pages allocations have touched rather than the whole file
+const SIZE_T BITMAP_PAGE_BYTES = 4096;
+
+// What O_DIRECT transfers have to be aligned to: the logical sector
+// size of nearly every device
+const size_t DIRECT_IO_ALIGN = 512;
+
 
 static SIZE_T mywrite(FILE *f, const SIZE_T off, const BYTE_T *buf, const int len) {
     SIZE_T left = len;
@@ -72,24 +93,31 @@ static SIZE_T myread(FILE *f, const SIZE_T off, BYTE_T *buf, const int len, bool
 DiskSystem::DiskSystem(const string &filestem, const bool create, const SIZE_T offset, const SIZE_T blcks,
                        const SIZE_T blcksize, const SIZE_T heads, const SIZE_T blckspertrack,
                        const SIZE_T tracks, const double avgseek, const double trackseek, const double rotlat) :
-        bitmap(0), datafilefd(0), configfilefd(0), bitmapfilefd(0), diskfilestem(filestem), offset(offset),
-        numblocks(blcks), blocksize(blcksize), numheads(heads), blockspertrack(blckspertrack),
-        numtracks(tracks), last_track(0), last_sector(0), averageseeklatency(avgseek), trackseeklatency(trackseek),
-        rotationallatency(rotlat) {
+        bitmap(0), datafilefd(0), configfilefd(0), bitmapfilefd(0), mapping(0),
+        mappingbytes(0), datafd(-1), directbuf(0), directbufbytes(0), engine(0), diskfilestem(filestem),
+        openstem(filestem), offset(offset), numblocks(blcks), blocksize(blcksize), numheads(heads),
+        blockspertrack(blckspertrack), numtracks(tracks), last_track(0), last_sector(0), averageseeklatency(avgseek), trackseeklatency(trackseek),
+        rotationallatency(rotlat), busyuntil(0), opened(false), backend(DISK_STDIO) {
     if (create) {
         // Only in this case are the parameters used:
-        InitFromInMemoryConfig();
+        opened = InitFromInMemoryConfig() == ERROR_NOERROR;
     } else {
-        InitFromConfigFile();
+        opened = InitFromConfigFile() == ERROR_NOERROR;
     }
 }
 
 DiskSystem::~DiskSystem() {
-    WriteConfig();
-    WriteBitMap();
-    fclose(configfilefd);
-    fclose(bitmapfilefd);
-    fclose(datafilefd);
+    StopAsync();
+    UnmapDataFile();
+    CloseDataFd();
+    free(directbuf);
+    if (opened) {
+        WriteConfig();
+        WriteDirtyBitMap();
+    }
+    if (configfilefd) { fclose(configfilefd); }
+    if (bitmapfilefd) { fclose(bitmapfilefd); }
+    if (datafilefd) { fclose(datafilefd); }
     delete[] bitmap;
 }
 
@@ -131,6 +159,7 @@ ERROR_T DiskSystem::WriteConfig() {
     fprintf(configfilefd, "%lf\n", trackseeklatency);
     fprintf(configfilefd, "# rotationalatency\n");
     fprintf(configfilefd, "%lf\n", rotationallatency);
+    fputs(modelconfig.c_str(), configfilefd);
     fflush(configfilefd);
 
     return ERROR_NOERROR;
@@ -169,35 +198,114 @@ ERROR_T DiskSystem::ReadConfig() {
     GETNEXTVAL;
     PARSEDOUBLE(&rotationallatency);
 
+    // The rest belongs to another kind of device, if any
+    modelconfig.clear();
+    while (fgets(buf, 80, configfilefd)) {
+        modelconfig += buf;
+    }
+
     return ERROR_NOERROR;
 }
 
 
+// The file keeps block 8k+j in bit 7-j of byte k, the reverse of the
+// in-memory words
+static BYTE_T reverse_bits(BYTE_T b) {
+    b = (b >> 4) | (b << 4);
+    b = ((b & 0xcc) >> 2) | ((b & 0x33) << 2);
+    return ((b & 0xaa) >> 1) | ((b & 0x55) << 1);
+}
+
+void DiskSystem::EncodeBitMap(const SIZE_T first, const SIZE_T n, BYTE_T *buf) const {
+    for (SIZE_T k = first; k < first + n; k++) {
+        buf[k - first] = reverse_bits((BYTE_T) (bitmap[k / 8] >> (8 * (k % 8))));
+    }
+}
+
 ERROR_T DiskSystem::WriteBitMap() {
     rewind(bitmapfilefd);
 
     SIZE_T numbitmapbytes = numblocks / 8 + (numblocks % 8 != 0);
+    vector<BYTE_T> bytes(numbitmapbytes);
 
-    if (mywrite(bitmapfilefd, 0, bitmap, numbitmapbytes) != numbitmapbytes) {
+    EncodeBitMap(0, numbitmapbytes, bytes.data());
+    if (mywrite(bitmapfilefd, 0, bytes.data(), numbitmapbytes) != numbitmapbytes) {
         cerr << "Can't write bitmap file\n";
         return ERROR_IMPLBUG;
     }
+    bitmapdirty.assign((numbitmapbytes + BITMAP_PAGE_BYTES - 1) / BITMAP_PAGE_BYTES, false);
+    dirtybitmappages.clear();
     return ERROR_NOERROR;
 }
 
+ERROR_T DiskSystem::WriteDirtyBitMap() {
+    SIZE_T numbitmapbytes = numblocks / 8 + (numblocks % 8 != 0);
+    vector<BYTE_T> bytes;
+
+    // Neighbouring pages go out in one write
+    sort(dirtybitmappages.begin(), dirtybitmappages.end());
+    for (SIZE_T i = 0; i < dirtybitmappages.size();) {
+        SIZE_T j = i + 1;
+        while (j < dirtybitmappages.size() && dirtybitmappages[j] == dirtybitmappages[j - 1] + 1) {
+            j++;
+        }
+        SIZE_T first = dirtybitmappages[i] * BITMAP_PAGE_BYTES;
+        SIZE_T n = min(numbitmapbytes, (dirtybitmappages[j - 1] + 1) * BITMAP_PAGE_BYTES) - first;
+
+        bytes.resize(n);
+        EncodeBitMap(first, n, bytes.data());
+        if (mywrite(bitmapfilefd, first, bytes.data(), n) != n) {
+            cerr << "Can't write bitmap file\n";
+            // what is left stays dirty for the next try
+            dirtybitmappages.erase(dirtybitmappages.begin(), dirtybitmappages.begin() + i);
+            return ERROR_IMPLBUG;
+        }
+        for (; i < j; i++) {
+            bitmapdirty[dirtybitmappages[i]] = false;
+        }
+    }
+    dirtybitmappages.clear();
+    return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::SyncBitMap() {
+    if (dirtybitmappages.empty()) {
+        return ERROR_NOERROR;
+    }
+    ERROR_T rc = WriteDirtyBitMap();
+    if (rc != ERROR_NOERROR) {
+        return rc;
+    }
+    if (fflush(bitmapfilefd) != 0) {
+        return ERROR_GENERAL;
+    }
+    return fdatasync(fileno(bitmapfilefd)) == 0 ? ERROR_NOERROR : ERROR_GENERAL;
+}
+
 ERROR_T DiskSystem::ReadBitMap() {
     rewind(bitmapfilefd);
 
     SIZE_T numbitmapbytes = numblocks / 8 + (numblocks % 8 != 0);
 
+    vector<BYTE_T> bytes(numbitmapbytes);
+
     if (bitmap) { delete[] bitmap; };
 
-    bitmap = new BYTE_T[numbitmapbytes];
+    bitmap = new unsigned long long[GetNumBitmapWords()]();
 
-    if (myread(bitmapfilefd, 0, bitmap, numbitmapbytes, false) != numbitmapbytes) {
+    if (myread(bitmapfilefd, 0, bytes.data(), numbitmapbytes, false) != numbitmapbytes) {
         cerr << "Can't read bitmap file\n";
         return ERROR_IMPLBUG;
     }
+    for (SIZE_T k = 0; k < numbitmapbytes; k++) {
+        bitmap[k / 8] |= (unsigned long long) reverse_bits(bytes[k]) << (8 * (k % 8));
+    }
+    // Stray bits past the last block would look like allocated blocks
+    if (numblocks % 64 != 0) {
+        bitmap[numblocks / 64] &= ~(~0ULL << (numblocks % 64));
+    }
+    bitmapdirty.assign((numbitmapbytes + BITMAP_PAGE_BYTES - 1) / BITMAP_PAGE_BYTES, false);
+    dirtybitmappages.clear();
     return ERROR_NOERROR;
 }
 
@@ -291,11 +399,7 @@ ERROR_T DiskSystem::InitFromInMemoryConfig() {
 
     // allocate in-memory bitmap
 
-    SIZE_T numbitmapbytes = numblocks / 8 + (numblocks % 8 != 0);
-
-    bitmap = new BYTE_T[numbitmapbytes];
-
-    memset(bitmap, 0, numbitmapbytes);
+    bitmap = new unsigned long long[GetNumBitmapWords()]();
 
     // create the bitmap file and write out the bitmap
 
@@ -333,11 +437,239 @@ ERROR_T DiskSystem::InitFromInMemoryConfig() {
 }
 
 
+ERROR_T DiskSystem::PreallocateDataFile(const int fd) {
+    size_t len = offset + (size_t) numblocks * blocksize;
+    struct stat s;
+
+    if (fstat(fd, &s) != 0) {
+        return ERROR_NOFILE;
+    }
+    // The stdio path grows the file as blocks are first read; the others
+    // need them all there from the start
+    if ((size_t) s.st_size < len && posix_fallocate(fd, s.st_size, len - s.st_size) != 0
+        && ftruncate(fd, len) != 0) {
+        return ERROR_NOSPACE;
+    }
+    return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::MapDataFile() {
+    int fd = fileno(datafilefd);
+    ERROR_T rc;
+
+    // Anything fwrite still holds has to reach the file first
+    fflush(datafilefd);
+    if ((rc = PreallocateDataFile(fd)) != ERROR_NOERROR) {
+        return rc;
+    }
+    mappingbytes = offset + (size_t) numblocks * blocksize;
+    void *p = mmap(0, mappingbytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        return ERROR_NOMEM;
+    }
+    mapping = (BYTE_T *) p;
+    return ERROR_NOERROR;
+}
+
+void DiskSystem::UnmapDataFile() {
+    if (mapping) {
+        msync(mapping, mappingbytes, MS_SYNC);
+        munmap(mapping, mappingbytes);
+        mapping = 0;
+    }
+}
+
+ERROR_T DiskSystem::OpenDataFd(const bool direct) {
+    string dataname = openstem + ".data";
+    int flags = O_RDWR;
+    ERROR_T rc;
+
+    if (direct) {
+        if (offset % DIRECT_IO_ALIGN != 0 || blocksize % DIRECT_IO_ALIGN != 0) {
+            cerr << "DiskSystem: O_DIRECT needs the offset and block size to be multiples of "
+            << DIRECT_IO_ALIGN << endl;
+            return ERROR_BADCONFIG;
+        }
+#ifdef O_DIRECT
+        flags |= O_DIRECT;
+#else
+        return ERROR_UNIMPL;
+#endif
+    }
+    fflush(datafilefd);
+    if ((datafd = open(dataname.c_str(), flags)) < 0) {
+        // EINVAL means the file system can't do O_DIRECT
+        return errno == EINVAL ? ERROR_UNIMPL : ERROR_NOFILE;
+    }
+    if ((rc = PreallocateDataFile(datafd)) != ERROR_NOERROR) {
+        CloseDataFd();
+        return rc;
+    }
+    return ERROR_NOERROR;
+}
+
+void DiskSystem::CloseDataFd() {
+    if (datafd >= 0) {
+        close(datafd);
+        datafd = -1;
+    }
+}
+
+ERROR_T DiskSystem::ReserveDirectBuffer(const SIZE_T n) {
+    size_t len = (size_t) n * blocksize;
+    void *p;
+
+    if (len <= directbufbytes) {
+        return ERROR_NOERROR;
+    }
+    if (posix_memalign(&p, DIRECT_IO_ALIGN, len) != 0) {
+        return ERROR_NOMEM;
+    }
+    free(directbuf);
+    directbuf = (BYTE_T *) p;
+    directbufbytes = len;
+    return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::SetBackend(const DiskBackend b) {
+    ERROR_T rc = ERROR_NOERROR;
+
+    if (b == backend) {
+        return ERROR_NOERROR;
+    }
+    StopAsync();
+    UnmapDataFile();
+    CloseDataFd();
+    // Whatever stdio holds is stale either way
+    fflush(datafilefd);
+    backend = DISK_STDIO;
+    if (b == DISK_MMAP) {
+        rc = MapDataFile();
+    } else if (b == DISK_PREAD || b == DISK_DIRECT) {
+        rc = OpenDataFd(b == DISK_DIRECT);
+    }
+    if (rc == ERROR_NOERROR) {
+        backend = b;
+    }
+    return rc;
+}
+
+const char *DiskSystem::GetBackendName() const {
+    switch (backend) {
+        case DISK_MMAP:
+            return "mmap";
+        case DISK_PREAD:
+            return "pread";
+        case DISK_DIRECT:
+            return "direct";
+        default:
+            return "stdio";
+    }
+}
+
+ERROR_T DiskSystem::ParseBackend(const string &name, DiskBackend &b) {
+    if (name == "stdio") {
+        b = DISK_STDIO;
+    } else if (name == "mmap") {
+        b = DISK_MMAP;
+    } else if (name == "pread") {
+        b = DISK_PREAD;
+    } else if (name == "direct") {
+        b = DISK_DIRECT;
+    } else {
+        return ERROR_BADCONFIG;
+    }
+    return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::Sync() {
+    ERROR_T rc = SyncBitMap();
+    if (rc != ERROR_NOERROR) {
+        return rc;
+    }
+    if (mapping) {
+        return msync(mapping, mappingbytes, MS_SYNC) == 0 ? ERROR_NOERROR : ERROR_GENERAL;
+    } else if (datafd >= 0) {
+        return fdatasync(datafd) == 0 ? ERROR_NOERROR : ERROR_GENERAL;
+    }
+    if (fflush(datafilefd) != 0) {
+        return ERROR_GENERAL;
+    }
+    return fdatasync(fileno(datafilefd)) == 0 ? ERROR_NOERROR : ERROR_GENERAL;
+}
+
+
+ERROR_T DiskSystem::StartAsync(const SIZE_T queuedepth, const bool threads) {
+    if (datafd < 0) {
+        // stdio and the mapping don't go through a descriptor
+        return ERROR_BADCONFIG;
+    }
+    StopAsync();
+    if (!(engine = IOEngine::Create(datafd, queuedepth, threads))) {
+        return ERROR_UNIMPL;
+    }
+    return ERROR_NOERROR;
+}
+
+void DiskSystem::StopAsync() {
+    delete engine;
+    engine = 0;
+}
+
+const char *DiskSystem::GetAsyncEngineName() const {
+    return engine ? engine->GetName() : "none";
+}
+
+ERROR_T DiskSystem::SubmitRead(const SIZE_T inoffblock, const SIZE_T numblock, BYTE_T *buf,
+                               const unsigned long long tag, double &reqtime) {
+    reqtime = 0;
+    if (!engine) {
+        return ERROR_BADCONFIG;
+    }
+    if (inoffblock + numblock > numblocks) {
+        cerr << "DiskSystem::SubmitRead: Attempt to read blocks " << inoffblock << " to "
+        << (inoffblock + numblock - 1) << ", but maxmimum block is only " << (numblocks - 1) << endl;
+        return ERROR_NOSPACE;
+    }
+    ERROR_T rc = engine->SubmitRead(offset + (off_t) inoffblock * blocksize, buf, (size_t) numblock * blocksize, tag);
+    if (rc == ERROR_NOERROR) {
+        reqtime = ModelAccess(inoffblock, numblock, false);
+    }
+    return rc;
+}
+
+ERROR_T DiskSystem::SubmitWrite(const SIZE_T inoffblock, const SIZE_T numblock, const BYTE_T *buf,
+                                const unsigned long long tag, double &reqtime) {
+    reqtime = 0;
+    if (!engine) {
+        return ERROR_BADCONFIG;
+    }
+    if (inoffblock + numblock > numblocks) {
+        cerr << "DiskSystem::SubmitWrite: Attempt to write blocks " << inoffblock << " to "
+        << (inoffblock + numblock - 1) << ", but maxmimum block is only " << (numblocks - 1) << endl;
+        return ERROR_NOSPACE;
+    }
+    ERROR_T rc = engine->SubmitWrite(offset + (off_t) inoffblock * blocksize, buf, (size_t) numblock * blocksize, tag);
+    if (rc == ERROR_NOERROR) {
+        reqtime = ModelAccess(inoffblock, numblock, true);
+    }
+    return rc;
+}
+
+ERROR_T DiskSystem::Wait(vector <IOCompletion> &done, const SIZE_T min) {
+    return engine ? engine->Wait(done, min) : ERROR_BADCONFIG;
+}
+
+SIZE_T DiskSystem::Poll(vector <IOCompletion> &done) {
+    return engine ? engine->Poll(done) : 0;
+}
+
+
 //
 // Note, this assumes disk is kept continously busy
 // or that time does not advance except during a disk op
 //
-double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock) {
+double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock, const bool write) {
 
     SIZE_T req_trackstart = (offblock) / (numheads * blockspertrack);
     SIZE_T req_sectorstart = (offblock) % (numheads * blockspertrack);
@@ -372,9 +704,78 @@ double DiskSystem::ModelAccess(const SIZE_T offblock, const SIZE_T numblock) {
 }
 
 
-ERROR_T DiskSystem::Read(const SIZE_T inoffblock,
-                         const SIZE_T numblock,
-                         vector <Block> &blocks,
+ERROR_T DiskSystem::Transfer(const bool write, const SIZE_T inoffblock, const SIZE_T numblock,
+                             const struct iovec *iov, const int iovcnt) {
+    const char *who = write ? "DiskSystem::Write" : "DiskSystem::Read";
+    off_t pos = offset + (off_t) inoffblock * blocksize;
+    size_t len = (size_t) numblock * blocksize;
+    size_t total = 0;
+
+    for (int i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    if (total != len) {
+        cerr << who << ": " << total << " bytes of memory for " << numblock << " blocks" << endl;
+        return ERROR_SIZE;
+    }
+    if (backend == DISK_DIRECT) {
+        // The whole request in one transfer, through an aligned buffer
+        if (ReserveDirectBuffer(numblock) != ERROR_NOERROR) {
+            return ERROR_NOMEM;
+        }
+        if (!write && pread(datafd, directbuf, len, pos) != (ssize_t) len) {
+            cerr << who << ": pread has failed" << endl;
+            return ERROR_IMPLBUG;
+        }
+        BYTE_T *p = directbuf;
+        for (int i = 0; i < iovcnt; p += iov[i].iov_len, i++) {
+            if (write) {
+                memcpy(p, iov[i].iov_base, iov[i].iov_len);
+            } else {
+                memcpy(iov[i].iov_base, p, iov[i].iov_len);
+            }
+        }
+        if (write && pwrite(datafd, directbuf, len, pos) != (ssize_t) len) {
+            cerr << who << ": pwrite has failed" << endl;
+            return ERROR_IMPLBUG;
+        }
+    } else if (mapping) {
+        for (int i = 0; i < iovcnt; pos += iov[i].iov_len, i++) {
+            if (write) {
+                memcpy(mapping + pos, iov[i].iov_base, iov[i].iov_len);
+            } else {
+                memcpy(iov[i].iov_base, mapping + pos, iov[i].iov_len);
+            }
+        }
+    } else if (datafd >= 0) {
+        // A call takes at most IOV_MAX pieces
+        for (int i = 0; i < iovcnt; i += IOV_MAX) {
+            int n = iovcnt - i < IOV_MAX ? iovcnt - i : IOV_MAX;
+            size_t want = 0;
+            for (int j = i; j < i + n; j++) {
+                want += iov[j].iov_len;
+            }
+            ssize_t done = write ? pwritev(datafd, iov + i, n, pos) : preadv(datafd, iov + i, n, pos);
+            if (done != (ssize_t) want) {
+                cerr << who << (write ? ": pwritev" : ": preadv") << " has failed" << endl;
+                return ERROR_IMPLBUG;
+            }
+            pos += want;
+        }
+    } else {
+        for (int i = 0; i < iovcnt; pos += iov[i].iov_len, i++) {
+            BYTE_T *p = (BYTE_T *) iov[i].iov_base;
+            SIZE_T n = iov[i].iov_len;
+            if (write ? mywrite(datafilefd, pos, p, n) != n : myread(datafilefd, pos, p, n, true) != n) {
+                cerr << who << (write ? ": mywrite" : ": myread") << " has failed" << endl;
+                return ERROR_IMPLBUG;
+            }
+        }
+    }
+    return ERROR_NOERROR;
+}
+
+ERROR_T DiskSystem::Read(const SIZE_T inoffblock, const SIZE_T numblock, const struct iovec *iov, const int iovcnt,
                          double &reqtime) {
     reqtime = 0;
     if (inoffblock + numblock > numblocks) {
@@ -382,24 +783,15 @@ ERROR_T DiskSystem::Read(const SIZE_T inoffblock,
         ", but maxmimum block is only " << (numblocks - 1) << endl;
         return ERROR_NOSPACE;
     }
-    reqtime = ModelAccess(inoffblock, numblock);
-    for (SIZE_T i = 0; i < numblock; i++) {
-        Block b(blocksize);
-        if (!IsBlockAllocated(inoffblock + i)) {
-            if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
-                cerr << "DiskSystem::Read: reading unallocated block " << (i + inoffblock) << endl;
-            }
-        }
-        if (myread(datafilefd, offset + (inoffblock + i) * blocksize, b.data, blocksize, true) != blocksize) {
-            cerr << "DiskSystem::Read: myread has failed" << endl;
-            return ERROR_IMPLBUG;
-        }
-        blocks.push_back(b);
+    if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS && CountAllocatedBlocks(inoffblock, numblock) < numblock) {
+        cerr << "DiskSystem::Read: reading unallocated blocks among " << inoffblock << " to "
+        << (inoffblock + numblock - 1) << endl;
     }
-    return ERROR_NOERROR;
+    reqtime = ModelAccess(inoffblock, numblock, false);
+    return Transfer(false, inoffblock, numblock, iov, iovcnt);
 }
 
-ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const SIZE_T numblock, const vector <Block> &blocks,
+ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const SIZE_T numblock, const struct iovec *iov, const int iovcnt,
                           double &reqtime) {
     reqtime = 0;
     if (inoffblock + numblock > numblocks) {
@@ -407,40 +799,72 @@ ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const SIZE_T numblock, const
         ", but maxmimum block is only " << (numblocks - 1) << endl;
         return ERROR_NOSPACE;
     }
-    reqtime = ModelAccess(inoffblock, numblock);
+    if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS && CountAllocatedBlocks(inoffblock, numblock) < numblock) {
+        cerr << "DiskSystem::Write: writing unallocated blocks among " << inoffblock << " to "
+        << (inoffblock + numblock - 1) << endl;
+    }
+    reqtime = ModelAccess(inoffblock, numblock, true);
+    return Transfer(true, inoffblock, numblock, iov, iovcnt);
+}
+
+ERROR_T DiskSystem::Read(const SIZE_T inoffblock, const SIZE_T numblock, BYTE_T *buf, double &reqtime) {
+    struct iovec iov;
+
+    iov.iov_base = buf;
+    iov.iov_len = (size_t) numblock * blocksize;
+    return Read(inoffblock, numblock, &iov, 1, reqtime);
+}
+
+ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const SIZE_T numblock, const BYTE_T *buf, double &reqtime) {
+    struct iovec iov;
+
+    iov.iov_base = (BYTE_T *) buf;
+    iov.iov_len = (size_t) numblock * blocksize;
+    return Write(inoffblock, numblock, &iov, 1, reqtime);
+}
+
+ERROR_T DiskSystem::Read(const SIZE_T inoffblock, const SIZE_T numblock, vector <Block> &blocks, double &reqtime) {
+    SIZE_T first = blocks.size();
+    vector<struct iovec> iov(numblock);
+    ERROR_T rc;
+
+    reqtime = 0;
+    blocks.resize(first + numblock);
     for (SIZE_T i = 0; i < numblock; i++) {
-        if (!IsBlockAllocated(inoffblock + i)) {
-            if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
-                cerr << "DiskSystem::Write: writing unallocated block " << (i + inoffblock) << endl;
-            }
-        }
-        if (mywrite(datafilefd, offset + (inoffblock + i) * blocksize, blocks[i].data, blocksize) != blocksize) {
-            cerr << "DiskSystem::Write: mywrite has failed" << endl;
-            return ERROR_IMPLBUG;
+        if (blocks[first + i].Resize(blocksize, false) != ERROR_NOERROR) {
+            blocks.resize(first);
+            return ERROR_NOMEM;
         }
+        iov[i].iov_base = blocks[first + i].data;
+        iov[i].iov_len = blocksize;
     }
-    return ERROR_NOERROR;
+    if ((rc = Read(inoffblock, numblock, iov.data(), numblock, reqtime)) != ERROR_NOERROR) {
+        blocks.resize(first);
+    }
+    return rc;
 }
 
+ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const SIZE_T numblock, const vector <Block> &blocks,
+                          double &reqtime) {
+    vector<struct iovec> iov(numblock);
+
+    for (SIZE_T i = 0; i < numblock; i++) {
+        iov[i].iov_base = blocks[i].data;
+        iov[i].iov_len = blocksize;
+    }
+    return Write(inoffblock, numblock, iov.data(), numblock, reqtime);
+}
 
 ERROR_T DiskSystem::Read(const SIZE_T inoffblock, Block &blocks, double &reqtime) {
-    vector <Block> bl;
-    ERROR_T rc = Read(inoffblock, 1, bl, reqtime);
-    if (rc != ERROR_NOERROR) {
-        return rc;
+    if (blocks.Resize(blocksize, false) != ERROR_NOERROR) {
+        reqtime = 0;
+        return ERROR_NOMEM;
     }
-    blocks = bl[0];
-    return ERROR_NOERROR;
+    return Read(inoffblock, 1, blocks.data, reqtime);
 }
 
 ERROR_T DiskSystem::Write(const SIZE_T inoffblock, const Block &blocks, double &reqtime) {
-    vector <Block> bl;
-    bl.push_back(blocks);
-    ERROR_T rc = Write(inoffblock, 1, bl, reqtime);
-    if (rc != ERROR_NOERROR) {
-        return rc;
-    }
-    return ERROR_NOERROR;
+    return Write(inoffblock, 1, blocks.data, reqtime);
 }
 
 
@@ -452,14 +876,193 @@ SIZE_T DiskSystem::GetNumBlocks() const {
     return numblocks;
 }
 
+const string &DiskSystem::GetFileStem() const {
+    return openstem;
+}
+
+SIZE_T DiskSystem::GetHeadPosition() const {
+    return last_track * numheads * blockspertrack + last_sector;
+}
+
+double DiskSystem::ScheduleRequest(const SIZE_T off, const SIZE_T num, const bool write, const double issuetime,
+                                   const double reqtime) {
+    double start = issuetime > busyuntil ? issuetime : busyuntil;
+    busyuntil = start + reqtime;
+    return busyuntil;
+}
+
+void DiskSystem::ResetSchedule() {
+    busyuntil = 0;
+}
+
+// The model named in filestem.config, or "" for a rotating disk
+static string config_model(const string &filestem) {
+    FILE *file = fopen((filestem + ".config").c_str(), "r");
+    char buf[80];
+    string model;
+
+    if (!file) {
+        return model;
+    }
+    while (fgets(buf, 80, file)) {
+        if (strcmp(buf, MODEL_HEADER) == 0) {
+            if (fgets(buf, 80, file)) {
+                model = string(buf, strcspn(buf, "\n"));
+            }
+            break;
+        }
+    }
+    fclose(file);
+    return model;
+}
+
+DiskSystem *DiskSystem::Open(const string &filestem) {
+    struct stat s;
+
+    if (stat((filestem + STRIPES_SUFFIX).c_str(), &s) == 0) {
+        StripedDiskSystem *d = new StripedDiskSystem(filestem);
+        if (!d->IsReady()) {
+            delete d;
+            return 0;
+        }
+        return d;
+    }
+    string model = config_model(filestem);
+    if (model.empty()) {
+        DiskSystem *d = new DiskSystem(filestem);
+        if (!d->IsReady()) {
+            delete d;
+            return 0;
+        }
+        return d;
+    }
+    FlashDiskSystem *d = new FlashDiskSystem(filestem);
+    if (!d->IsReady()) {
+        delete d;
+        return 0;
+    }
+    return d;
+}
+
+
+// The bits of word w that stand for blocks lo to hi-1; w must hold at
+// least one of them
+static inline unsigned long long range_mask(const SIZE_T w, const SIZE_T lo, const SIZE_T hi) {
+    unsigned long long base = (unsigned long long) w * 64;
+    unsigned long long mask = ~0ULL;
 
-#define GETBIT(x) ((bitmap[(x)/8] >> (7-((x)%8))) & 0x1)
-#define SETBIT(x) do { bitmap[(x)/8] |= 0x1 << (7-((x)%8)); } while (0)
-#define CLEARBIT(x) do { bitmap[(x)/8] &= ~(0x1 << (7-((x)%8))); } while (0)
+    if (lo > base) {
+        mask &= ~0ULL << (lo - base);
+    }
+    if (hi < base + 64) {
+        mask &= ~(~0ULL << (hi - base));
+    }
+    return mask;
+}
 
 
 bool DiskSystem::IsBlockAllocated(const SIZE_T block) {
-    return GETBIT(block);
+    return bitmap[block / 64] >> (block % 64) & 0x1;
+}
+
+void DiskSystem::SetBitmapRange(const SIZE_T first, const SIZE_T n, const bool allocated) {
+    if (n == 0) {
+        return;
+    }
+    SIZE_T last = (first + n - 1) / 64;
+
+    for (SIZE_T p = first / (8 * BITMAP_PAGE_BYTES); p <= (first + n - 1) / (8 * BITMAP_PAGE_BYTES); p++) {
+        if (!bitmapdirty[p]) {
+            bitmapdirty[p] = true;
+            dirtybitmappages.push_back(p);
+        }
+    }
+    for (SIZE_T w = first / 64; w <= last; w++) {
+        if (allocated) {
+            bitmap[w] |= range_mask(w, first, first + n);
+        } else {
+            bitmap[w] &= ~range_mask(w, first, first + n);
+        }
+    }
+}
+
+SIZE_T DiskSystem::CountAllocatedBlocks(const SIZE_T first, const SIZE_T n) const {
+    if (n == 0) {
+        return 0;
+    }
+    SIZE_T last = (first + n - 1) / 64;
+    SIZE_T count = 0;
+
+    for (SIZE_T w = first / 64; w <= last; w++) {
+        count += __builtin_popcountll(bitmap[w] & range_mask(w, first, first + n));
+    }
+    return count;
+}
+
+bool DiskSystem::NextFreeExtent(const SIZE_T from, const SIZE_T end, SIZE_T &start, SIZE_T &len) const {
+    if (from >= end) {
+        return false;
+    }
+    SIZE_T last = (end - 1) / 64;
+    SIZE_T w = from / 64;
+    unsigned long long bits;
+
+    // Skips allocated words for the first free block
+    while ((bits = ~bitmap[w] & range_mask(w, from, end)) == 0) {
+        if (++w > last) {
+            return false;
+        }
+    }
+    start = w * 64 + __builtin_ctzll(bits);
+
+    // then free words for the first allocated one, treating the blocks
+    // past end as allocated
+    bits = (bitmap[w] | ~range_mask(w, 0, end)) & (~0ULL << (start % 64));
+    while (bits == 0) {
+        if (++w > last) {
+            len = end - start;
+            return true;
+        }
+        bits = bitmap[w] | ~range_mask(w, 0, end);
+    }
+    len = w * 64 + __builtin_ctzll(bits) - start;
+    return true;
+}
+
+ERROR_T DiskSystem::FindFreeRun(const SIZE_T n, const SIZE_T hint, SIZE_T &first) const {
+    if (n == 0 || n > numblocks) {
+        return ERROR_NOSPACE;
+    }
+    SIZE_T from = hint < numblocks ? hint : 0;
+    SIZE_T start, len;
+
+    // From the hint to the end, then runs that start before the hint
+    SIZE_T lo[2] = { from, 0 };
+    SIZE_T hi[2] = { numblocks, from + n - 1 < numblocks ? from + n - 1 : numblocks };
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (SIZE_T b = lo[pass]; NextFreeExtent(b, hi[pass], start, len); b = start + len) {
+            if (len >= n) {
+                first = start;
+                return ERROR_NOERROR;
+            }
+        }
+    }
+    return ERROR_NOSPACE;
+}
+
+void DiskSystem::GetFreeSpaceSummary(SIZE_T &numfree, SIZE_T &numextents, SIZE_T &largest) const {
+    SIZE_T start, len;
+
+    numfree = numblocks - CountAllocatedBlocks(0, numblocks);
+    numextents = 0;
+    largest = 0;
+    for (SIZE_T b = 0; NextFreeExtent(b, numblocks, start, len); b = start + len) {
+        numextents++;
+        if (len > largest) {
+            largest = len;
+        }
+    }
 }
 
 
@@ -469,15 +1072,15 @@ ERROR_T DiskSystem::NotifyAllocateBlocks(const SIZE_T offset, const SIZE_T innum
         (offset + innumblocks - 1) << " but maximum block is " << (numblocks - 1) << endl;
         return ERROR_NOSUCHBLOCK;
     }
-    for (SIZE_T i = offset; i < (offset + innumblocks); i++) {
-        if (IsBlockAllocated(i)) {
-            if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+    if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS && CountAllocatedBlocks(offset, innumblocks) > 0) {
+        for (SIZE_T i = offset; i < (offset + innumblocks); i++) {
+            if (IsBlockAllocated(i)) {
                 cerr << "Disksystem: NotifyAllocateBlocks: Block " << i <<
                 " is being allocated, but it's already allocated!" << endl;
             }
         }
-        SETBIT(i);
     }
+    SetBitmapRange(offset, innumblocks, true);
     return ERROR_NOERROR;
 }
 
@@ -487,15 +1090,15 @@ ERROR_T DiskSystem::NotifyDeallocateBlocks(const SIZE_T offset, const SIZE_T inn
         (offset + innumblocks - 1) << " but maximum block is " << (numblocks - 1) << endl;
         return ERROR_NOSUCHBLOCK;
     }
-    for (SIZE_T i = offset; i < (offset + innumblocks); i++) {
-        if (!IsBlockAllocated(i)) {
-            if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS) {
+    if (PRINT_DISKSYSTEM_ALLOCATION_ERRORS && CountAllocatedBlocks(offset, innumblocks) < innumblocks) {
+        for (SIZE_T i = offset; i < (offset + innumblocks); i++) {
+            if (!IsBlockAllocated(i)) {
                 cerr << "Disksystem: NotifyDeallocateBlocks: Block " << i <<
                 " is being deallocated, but it's already deallocated!" << endl;
             }
         }
-        CLEARBIT(i);
     }
+    SetBitmapRange(offset, innumblocks, false);
     return ERROR_NOERROR;
 }
 
@@ -515,7 +1118,7 @@ ostream &DiskSystem::Print(ostream &os) const {
     << ", rotationallatency=" << rotationallatency
     << ", bitmap=";
     for (SIZE_T i = 0; i < numblocks; i++) {
-        if (GETBIT(i)) {
+        if (bitmap[i / 64] >> (i % 64) & 0x1) {
             os << "*";
         } else {
             os << ".";
@@ -528,3 +1131,553 @@ ostream &DiskSystem::Print(ostream &os) const {
   
 
 
+
+
+//
+// Striped
+//
+
+static string member_stem(const string &filestem, const SIZE_T m) {
+    char suffix[16];
+    sprintf(suffix, ".%u", m);
+    return filestem + suffix;
+}
+
+StripedDiskSystem::StripedDiskSystem(const string &filestem) : DiskSystem(filestem), stripeblocks(0), lastblock(0) {
+    string name = filestem + STRIPES_SUFFIX;
+    FILE *file = fopen(name.c_str(), "r");
+    char buf[80];
+    SIZE_T k = 0;
+    struct stat s;
+
+    if (!file) {
+        return;
+    }
+    buf[0] = 0;
+    while (fgets(buf, 80, file) && buf[0] == '#') {
+    }
+    fclose(file);
+    if (sscanf(buf, "%u %u", &k, &stripeblocks) != 2 || k < 1 || stripeblocks < 1
+        || GetNumBlocks() % (k * stripeblocks) != 0) {
+        cerr << "StripedDiskSystem: bad layout in " << name << endl;
+        return;
+    }
+    bool ok = true;
+    for (SIZE_T m = 0; m < k && ok; m++) {
+        string stem = member_stem(filestem, m);
+        if (stat((stem + ".config").c_str(), &s) != 0) {
+            cerr << "StripedDiskSystem: member " << stem << " is missing\n";
+            ok = false;
+            break;
+        }
+        DiskSystem *d = new DiskSystem(stem);
+        members.push_back(d);
+        if (!d->IsReady() || d->GetNumBlocks() != GetNumBlocks() / k || d->GetBlockSize() != GetBlockSize()) {
+            cerr << "StripedDiskSystem: member " << stem << " doesn't fit the array\n";
+            ok = false;
+        }
+    }
+    if (!ok) {
+        for (SIZE_T m = 0; m < members.size(); m++) {
+            delete members[m];
+        }
+        members.clear();
+    }
+}
+
+StripedDiskSystem::~StripedDiskSystem() {
+    for (SIZE_T m = 0; m < members.size(); m++) {
+        delete members[m];
+    }
+}
+
+ERROR_T StripedDiskSystem::Create(const string &filestem, const SIZE_T nummembers, const SIZE_T stripeblocks,
+                                  const SIZE_T blocks, const SIZE_T blocksize, const SIZE_T heads,
+                                  const SIZE_T blockspertrack, const SIZE_T tracks, const double avgseek,
+                                  const double trackseek, const double rotlat) {
+    string name = filestem + STRIPES_SUFFIX;
+    struct stat s;
+
+    if (nummembers < 1 || stripeblocks < 1 || tracks % nummembers != 0 || blocks % (nummembers * stripeblocks) != 0) {
+        cerr << "StripedDiskSystem: the tracks must split evenly over the members, and the blocks into whole"
+        << " stripes across them\n";
+        return ERROR_BADCONFIG;
+    }
+    if (stat(name.c_str(), &s) == 0 || stat((filestem + ".config").c_str(), &s) == 0) {
+        cerr << "Configuration or stripe files exist for this name!\n";
+        return ERROR_BADCONFIG;
+    }
+    for (SIZE_T m = 0; m < nummembers; m++) {
+        if (stat((member_stem(filestem, m) + ".config").c_str(), &s) == 0) {
+            cerr << "Configuration files exist for member " << m << "!\n";
+            return ERROR_BADCONFIG;
+        }
+    }
+
+    {
+        DiskSystem array(filestem, true, 0, blocks, blocksize, heads, blockspertrack, tracks, avgseek, trackseek,
+                         rotlat);
+    }
+    for (SIZE_T m = 0; m < nummembers; m++) {
+        DiskSystem member(member_stem(filestem, m), true, 0, blocks / nummembers, blocksize, heads, blockspertrack,
+                          tracks / nummembers, avgseek, trackseek, rotlat);
+    }
+
+    FILE *file = fopen(name.c_str(), "w");
+    if (!file) {
+        return ERROR_NOFILE;
+    }
+    fprintf(file, "# striped disk version 1\n");
+    fprintf(file, "# members stripeblocks\n");
+    fprintf(file, "%u %u\n", nummembers, stripeblocks);
+    fclose(file);
+    return ERROR_NOERROR;
+}
+
+void StripedDiskSystem::MemberRange(const SIZE_T m, const SIZE_T off, const SIZE_T num, SIZE_T &first,
+                                    SIZE_T &count) const {
+    SIZE_T k = members.size();
+    SIZE_T s = off / stripeblocks;
+
+    // The member's stripes are k apart, and its blocks of consecutive
+    // ones are contiguous on it
+    s += (m + k - s % k) % k;
+    count = 0;
+    for (; s * stripeblocks < off + num; s += k) {
+        SIZE_T lo = s * stripeblocks > off ? s * stripeblocks : off;
+        SIZE_T hi = (s + 1) * stripeblocks < off + num ? (s + 1) * stripeblocks : off + num;
+        if (count == 0) {
+            first = (s / k) * stripeblocks + lo % stripeblocks;
+        }
+        count += hi - lo;
+    }
+}
+
+void StripedDiskSystem::SplitIov(const SIZE_T off, const struct iovec *iov, const int iovcnt,
+                                 vector<vector<struct iovec> > &parts) const {
+    unsigned long long stripebytes = (unsigned long long) stripeblocks * GetBlockSize();
+    unsigned long long at = (unsigned long long) off * GetBlockSize();
+
+    for (int i = 0; i < iovcnt; i++) {
+        struct iovec piece = iov[i];
+        while (piece.iov_len > 0) {
+            size_t left = stripebytes - at % stripebytes;
+            struct iovec cut = piece;
+            cut.iov_len = piece.iov_len < left ? piece.iov_len : left;
+            parts[(at / stripebytes) % parts.size()].push_back(cut);
+            piece.iov_base = (BYTE_T *) piece.iov_base + cut.iov_len;
+            piece.iov_len -= cut.iov_len;
+            at += cut.iov_len;
+        }
+    }
+}
+
+ERROR_T StripedDiskSystem::Read(const SIZE_T inoffblock, const SIZE_T numblock, const struct iovec *iov,
+                                const int iovcnt, double &reqtime) {
+    SIZE_T k = members.size();
+    vector<vector<struct iovec> > parts(k);
+    SIZE_T first, count;
+    double t;
+    ERROR_T rc;
+
+    reqtime = 0;
+    if (inoffblock + numblock > GetNumBlocks()) {
+        cerr << "StripedDiskSystem::Read: Attempt to read blocks " << inoffblock << " to "
+        << (inoffblock + numblock - 1) << ", but maxmimum block is only " << (GetNumBlocks() - 1) << endl;
+        return ERROR_NOSPACE;
+    }
+    SplitIov(inoffblock, iov, iovcnt, parts);
+    lastparts.clear();
+    for (SIZE_T m = 0; m < k; m++) {
+        MemberRange(m, inoffblock, numblock, first, count);
+        if (count == 0) {
+            continue;
+        }
+        if ((rc = members[m]->Read(first, count, parts[m].data(), parts[m].size(), t)) != ERROR_NOERROR) {
+            return rc;
+        }
+        lastparts.push_back(make_pair(m, t));
+        reqtime = t > reqtime ? t : reqtime;
+    }
+    lastblock = inoffblock + numblock - 1;
+    return ERROR_NOERROR;
+}
+
+ERROR_T StripedDiskSystem::Write(const SIZE_T inoffblock, const SIZE_T numblock, const struct iovec *iov,
+                                 const int iovcnt, double &reqtime) {
+    SIZE_T k = members.size();
+    vector<vector<struct iovec> > parts(k);
+    SIZE_T first, count;
+    double t;
+    ERROR_T rc;
+
+    reqtime = 0;
+    if (inoffblock + numblock > GetNumBlocks()) {
+        cerr << "StripedDiskSystem::Write: Attempt to write blocks " << inoffblock << " to "
+        << (inoffblock + numblock - 1) << ", but maxmimum block is only " << (GetNumBlocks() - 1) << endl;
+        return ERROR_NOSPACE;
+    }
+    SplitIov(inoffblock, iov, iovcnt, parts);
+    lastparts.clear();
+    for (SIZE_T m = 0; m < k; m++) {
+        MemberRange(m, inoffblock, numblock, first, count);
+        if (count == 0) {
+            continue;
+        }
+        if ((rc = members[m]->Write(first, count, parts[m].data(), parts[m].size(), t)) != ERROR_NOERROR) {
+            return rc;
+        }
+        lastparts.push_back(make_pair(m, t));
+        reqtime = t > reqtime ? t : reqtime;
+    }
+    lastblock = inoffblock + numblock - 1;
+    return ERROR_NOERROR;
+}
+
+double StripedDiskSystem::ScheduleRequest(const SIZE_T off, const SIZE_T num, const bool write,
+                                          const double issuetime, const double reqtime) {
+    if (lastparts.empty()) {
+        return DiskSystem::ScheduleRequest(off, num, write, issuetime, reqtime);
+    }
+    double done = issuetime;
+    SIZE_T first, count;
+    for (SIZE_T i = 0; i < lastparts.size(); i++) {
+        SIZE_T m = lastparts[i].first;
+        MemberRange(m, off, num, first, count);
+        double d = members[m]->ScheduleRequest(first, count, write, issuetime, lastparts[i].second);
+        done = d > done ? d : done;
+    }
+    lastparts.clear();
+    return done;
+}
+
+void StripedDiskSystem::ResetSchedule() {
+    DiskSystem::ResetSchedule();
+    for (SIZE_T m = 0; m < members.size(); m++) {
+        members[m]->ResetSchedule();
+    }
+    lastparts.clear();
+}
+
+ERROR_T StripedDiskSystem::SetBackend(const DiskBackend b) {
+    ERROR_T rc;
+
+    for (SIZE_T m = 0; m < members.size(); m++) {
+        if ((rc = members[m]->SetBackend(b)) != ERROR_NOERROR) {
+            return rc;
+        }
+    }
+    backend = b;
+    return ERROR_NOERROR;
+}
+
+ERROR_T StripedDiskSystem::Sync() {
+    ERROR_T rc = SyncBitMap();
+
+    for (SIZE_T m = 0; m < members.size(); m++) {
+        ERROR_T r = members[m]->Sync();
+        rc = rc == ERROR_NOERROR ? r : rc;
+    }
+    return rc;
+}
+
+SIZE_T StripedDiskSystem::GetHeadPosition() const {
+    return lastblock;
+}
+
+ostream &StripedDiskSystem::Print(ostream &os) const {
+    os << "StripedDiskSystem(members=" << members.size() << ", stripeblocks=" << stripeblocks << ", array=";
+    DiskSystem::Print(os);
+    for (SIZE_T m = 0; m < members.size(); m++) {
+        os << ", member" << m << "=";
+        members[m]->Print(os);
+    }
+    os << ")";
+    return os;
+}
+
+
+//
+// Flash
+//
+
+static string flash_config(const string &model, const FlashParams &p, const double pageswritten) {
+    char buf[512];
+
+    snprintf(buf, sizeof(buf),
+             "%s%s\n"
+             "# pagesize channels diesperchannel readlatency programlatency eraselatency pagesperblock\n"
+             "# overprovision commandlatency channelbandwidth hostbandwidth queuedepth\n"
+             "%u %u %u %lf %lf %lf %u %lf %lf %lf %lf %u\n"
+             "# pageswritten\n"
+             "%.0lf\n",
+             MODEL_HEADER, model.c_str(), p.pagesize, p.channels, p.diesperchannel, p.readlatency,
+             p.programlatency, p.eraselatency, p.pagesperblock, p.overprovision, p.commandlatency,
+             p.channelbandwidth, p.hostbandwidth, p.queuedepth, pageswritten);
+    return buf;
+}
+
+FlashDiskSystem::FlashDiskSystem(const string &filestem) :
+        DiskSystem(filestem), ready(false), pageswritten(0), hostpages(0), gcpages(0), erases(0), linkbusy(0),
+        lastblock(0) {
+    vector<string> lines;
+    FlashParams &p = params;
+
+    for (SIZE_T i = 0; i < modelconfig.size();) {
+        SIZE_T j = modelconfig.find('\n', i);
+        if (j == string::npos) {
+            j = modelconfig.size();
+        }
+        if (j > i && modelconfig[i] != '#') {
+            lines.push_back(modelconfig.substr(i, j - i));
+        }
+        i = j + 1;
+    }
+    if (lines.size() < 3
+        || sscanf(lines[1].c_str(), "%u %u %u %lf %lf %lf %u %lf %lf %lf %lf %u", &p.pagesize, &p.channels,
+                  &p.diesperchannel, &p.readlatency, &p.programlatency, &p.eraselatency, &p.pagesperblock,
+                  &p.overprovision, &p.commandlatency, &p.channelbandwidth, &p.hostbandwidth, &p.queuedepth) != 12
+        || sscanf(lines[2].c_str(), "%lf", &pageswritten) != 1) {
+        cerr << "FlashDiskSystem: no model and parameters in " << filestem << ".config\n";
+        return;
+    }
+    model = lines[0];
+    if (p.pagesize < 1 || p.channels < 1 || p.diesperchannel < 1 || p.pagesperblock < 1 || p.queuedepth < 1
+        || p.readlatency < 0 || p.programlatency < 0 || p.eraselatency < 0 || p.commandlatency < 0
+        || p.overprovision <= 0 || p.channelbandwidth <= 0 || p.hostbandwidth <= 0) {
+        cerr << "FlashDiskSystem: impossible parameters in " << filestem << ".config\n";
+        return;
+    }
+    diebusy.assign(GetNumDies(), 0);
+    channelbusy.assign(p.channels, 0);
+    ready = true;
+}
+
+FlashDiskSystem::~FlashDiskSystem() {
+    // The base class writes the config out
+    if (ready) {
+        SaveModelConfig();
+    }
+}
+
+void FlashDiskSystem::SaveModelConfig() {
+    modelconfig = flash_config(model, params, pageswritten);
+}
+
+ERROR_T FlashDiskSystem::GetPreset(const string &model, FlashParams &p) {
+    if (model == "ssd") {
+        // A SATA drive of TLC flash
+        FlashParams ssd = { 4096, 8, 4, 0.06, 0.7, 3.5, 256, 0.07, 0.02, 400, 550, 32 };
+        p = ssd;
+    } else if (model == "nvme") {
+        // A datacenter NVMe drive, more parallel and overprovisioned
+        FlashParams nvme = { 4096, 16, 8, 0.05, 0.5, 3, 256, 0.28, 0.005, 1200, 3500, 1024 };
+        p = nvme;
+    } else {
+        return ERROR_BADCONFIG;
+    }
+    return ERROR_NOERROR;
+}
+
+ERROR_T FlashDiskSystem::Create(const string &filestem, const SIZE_T blocks, const SIZE_T blocksize,
+                                const string &model) {
+    string name = filestem + ".config";
+    FlashParams p;
+    struct stat s;
+
+    if (GetPreset(model, p) != ERROR_NOERROR) {
+        cerr << "FlashDiskSystem: the models are ssd and nvme\n";
+        return ERROR_BADCONFIG;
+    }
+    if (stat(name.c_str(), &s) == 0) {
+        cerr << "Configuration files exist for this name!\n";
+        return ERROR_BADCONFIG;
+    }
+    {
+        DiskSystem disk(filestem, true, 0, blocks, blocksize, 1, blocks, 1, 1, 1, 1);
+    }
+    FILE *file = fopen(name.c_str(), "a");
+    if (!file) {
+        return ERROR_NOFILE;
+    }
+    fputs(flash_config(model, p, 0).c_str(), file);
+    fclose(file);
+    return ERROR_NOERROR;
+}
+
+double FlashDiskSystem::GetWriteAmplification(const double written) const {
+    double op = params.overprovision;
+    double logicalpages = ceil((double) GetNumBlocks() * GetBlockSize() / params.pagesize);
+
+    if (written < logicalpages * (1 + op)) {
+        // There are still pages that have never been programmed
+        return 1;
+    }
+    return (1 + op) / (2 * op);
+}
+
+unsigned long long FlashDiskSystem::GetNumPages(const SIZE_T off, const SIZE_T num) const {
+    unsigned long long ps = params.pagesize;
+
+    if (num == 0) {
+        return 0;
+    }
+    return ((unsigned long long) (off + num) * GetBlockSize() - 1) / ps
+           - (unsigned long long) off * GetBlockSize() / ps + 1;
+}
+
+void FlashDiskSystem::SplitRequest(const SIZE_T off, const SIZE_T num, const bool write, const double wa,
+                                   vector <DiePart> &parts, double &linktime) const {
+    unsigned long long first = (unsigned long long) off * GetBlockSize();
+    unsigned long long end = (unsigned long long) (off + num) * GetBlockSize();
+    unsigned long long ps = params.pagesize;
+    SIZE_T numdies = GetNumDies();
+    // MB/s is bytes per ms over 1000
+    double pagetransfer = ps / (params.channelbandwidth * 1000);
+    double pagenand = !write ? params.readlatency
+                             : params.programlatency + (wa - 1) * (params.readlatency + params.programlatency)
+                               + wa / params.pagesperblock * params.eraselatency;
+    vector<double> nand(numdies, 0);
+
+    parts.clear();
+    linktime = (end - first) / (params.hostbandwidth * 1000);
+    if (num == 0) {
+        return;
+    }
+    unsigned long long firstpage = first / ps, lastpage = (end - 1) / ps;
+    if (write && first % ps != 0) {
+        // The rest of the page is read so it can be programmed whole
+        nand[firstpage % numdies] += params.readlatency;
+    }
+    if (write && end % ps != 0 && (lastpage != firstpage || first % ps == 0)) {
+        nand[lastpage % numdies] += params.readlatency;
+    }
+    // Die d has every numdies-th page, from the first of the request on it
+    unsigned long long numpages = lastpage - firstpage + 1;
+    for (SIZE_T d = 0; d < numdies; d++) {
+        unsigned long long skip = (d + numdies - firstpage % numdies) % numdies;
+        if (skip < numpages) {
+            unsigned long long pages = (numpages - skip + numdies - 1) / numdies;
+            DiePart part = { d, nand[d] + pages * pagenand, pages * pagetransfer };
+            parts.push_back(part);
+        }
+    }
+}
+
+double FlashDiskSystem::ModelAccess(const SIZE_T off, const SIZE_T num, const bool write) {
+    vector <DiePart> parts;
+    vector<double> channel(params.channels, 0);
+    double wa = GetWriteAmplification();
+    double linktime, slowest = 0;
+
+    if (num == 0) {
+        return 0;
+    }
+    SplitRequest(off, num, write, wa, parts, linktime);
+    if (write) {
+        double pages = GetNumPages(off, num);
+        hostpages += pages;
+        gcpages += pages * (wa - 1);
+        erases += pages * wa / params.pagesperblock;
+        pageswritten += pages * wa;
+    }
+    for (SIZE_T i = 0; i < parts.size(); i++) {
+        const DiePart &p = parts[i];
+        slowest = p.nandtime + p.transfertime > slowest ? p.nandtime + p.transfertime : slowest;
+        channel[p.die % params.channels] += p.transfertime;
+    }
+    for (SIZE_T c = 0; c < params.channels; c++) {
+        slowest = channel[c] > slowest ? channel[c] : slowest;
+    }
+    lastblock = off + num - 1;
+    return params.commandlatency + linktime + slowest;
+}
+
+double FlashDiskSystem::ScheduleRequest(const SIZE_T off, const SIZE_T num, const bool write,
+                                        const double issuetime, const double) {
+    vector <DiePart> parts;
+    double linktime;
+    double start = issuetime;
+
+    // ModelAccess has added the pages in; until the device had been
+    // written over it counted each once
+    double wa = GetWriteAmplification(write ? pageswritten - GetNumPages(off, num) : pageswritten);
+
+    SplitRequest(off, num, write, wa, parts, linktime);
+
+    // A full device takes the next request when its first one finishes
+    while (!inside.empty() && *inside.begin() <= start) {
+        inside.erase(inside.begin());
+    }
+    if (inside.size() >= params.queuedepth) {
+        start = *inside.begin();
+        inside.erase(inside.begin());
+    }
+    start += params.commandlatency;
+
+    double done = start;
+    if (write) {
+        // Over the link, then to each die through its channel
+        linkbusy = (linkbusy > start ? linkbusy : start) + linktime;
+        done = linkbusy;
+        for (SIZE_T i = 0; i < parts.size(); i++) {
+            const DiePart &p = parts[i];
+            double &die = diebusy[p.die], &channel = channelbusy[p.die % params.channels];
+            double t = die > linkbusy ? die : linkbusy;
+            t = channel > t ? channel : t;
+            channel = t + p.transfertime;
+            die = t + p.transfertime + p.nandtime;
+            done = die > done ? die : done;
+        }
+    } else {
+        // Out of each die through its channel, then over the link
+        for (SIZE_T i = 0; i < parts.size(); i++) {
+            const DiePart &p = parts[i];
+            double &die = diebusy[p.die], &channel = channelbusy[p.die % params.channels];
+            double t = (die > start ? die : start) + p.nandtime;
+            t = channel > t ? channel : t;
+            channel = die = t + p.transfertime;
+            done = die > done ? die : done;
+        }
+        linkbusy = (linkbusy > done ? linkbusy : done) + linktime;
+        done = linkbusy;
+    }
+    inside.insert(done);
+    return done;
+}
+
+void FlashDiskSystem::ResetSchedule() {
+    diebusy.assign(diebusy.size(), 0);
+    channelbusy.assign(channelbusy.size(), 0);
+    linkbusy = 0;
+    inside.clear();
+}
+
+SIZE_T FlashDiskSystem::GetHeadPosition() const {
+    return lastblock;
+}
+
+ostream &FlashDiskSystem::Print(ostream &os) const {
+    os << "FlashDiskSystem(model=" << model
+    << ", pagesize=" << params.pagesize
+    << ", channels=" << params.channels
+    << ", diesperchannel=" << params.diesperchannel
+    << ", readlatency=" << params.readlatency
+    << ", programlatency=" << params.programlatency
+    << ", eraselatency=" << params.eraselatency
+    << ", pagesperblock=" << params.pagesperblock
+    << ", overprovision=" << params.overprovision
+    << ", commandlatency=" << params.commandlatency
+    << ", channelbandwidth=" << params.channelbandwidth
+    << ", hostbandwidth=" << params.hostbandwidth
+    << ", queuedepth=" << params.queuedepth
+    << ", pageswritten=" << pageswritten
+    << ", writeamplification=" << GetWriteAmplification()
+    << ", hostpages=" << hostpages
+    << ", gcpages=" << gcpages
+    << ", erases=" << erases
+    << ", array=";
+    DiskSystem::Print(os);
+    os << ")";
+    return os;
+}
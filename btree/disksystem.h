@@ -3,13 +3,24 @@
 
 #include <string>
 #include <iostream>
+#include <set>
 #include <vector>
+#include <sys/uio.h>
 
 #include "global.h"
 #include "block.h"
+#include "asyncio.h"
 
 using namespace std;
 
+// How block bytes get to and from filestem.data
+enum DiskBackend {
+    DISK_STDIO,     // fseek and fread/fwrite
+    DISK_MMAP,      // memcpy to and from a shared mapping of the file
+    DISK_PREAD,     // pread/pwrite on a descriptor of its own
+    DISK_DIRECT     // the same with O_DIRECT, bypassing the page cache
+};
+
 // Models a single disk with a single outstanding request
 //
 // Includes storage allocator and free space bitmap to 
@@ -17,16 +28,28 @@ using namespace std;
 //
 class DiskSystem {
 private:
-    BYTE_T *bitmap;
+    // Bit i of word w is block 64w+i, set if allocated; the bits past
+    // the last block are clear
+    unsigned long long *bitmap;
+    vector<bool> bitmapdirty;           // by page of the bitmap file
+    vector<SIZE_T> dirtybitmappages;    // the same pages, as a list
     FILE *datafilefd;
     FILE *configfilefd;
     FILE *bitmapfilefd;
 
+    BYTE_T *mapping;        // the whole data file, under DISK_MMAP
+    size_t mappingbytes;
+    int datafd;             // under DISK_PREAD and DISK_DIRECT
+    BYTE_T *directbuf;      // aligned, one request's worth, under DISK_DIRECT
+    size_t directbufbytes;
+    IOEngine *engine;       // on datafd, once StartAsync is called
+
 
     //
     //
 
     string diskfilestem;
+    string openstem;        // the files' names as opened, which the config's may not match
     SIZE_T offset;
     SIZE_T numblocks;
     SIZE_T blocksize;
@@ -41,8 +64,15 @@ private:
     double trackseeklatency;
     double rotationallatency;
 
+    double busyuntil;       // simulated time the queued requests finish
+    bool opened;            // the config, data and bitmap files were all read or made
+
 protected:
-    virtual double ModelAccess(const SIZE_T off, const SIZE_T num);
+    DiskBackend backend;
+    string modelconfig;     // what follows the rotating disk's parameters in filestem.config
+
+    // Milliseconds the request takes on its own
+    virtual double ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
 
     ERROR_T SanityCheckConfig();
 
@@ -56,8 +86,46 @@ protected:
 
     ERROR_T ReadBitMap();
 
+    // All of it, leaving no page dirty
     ERROR_T WriteBitMap();
 
+    // The bytes first to first+n-1 of the bitmap as filestem.bitmap has them
+    void EncodeBitMap(const SIZE_T first, const SIZE_T n, BYTE_T *buf) const;
+
+    // Only the pages of the bitmap file that changed since they were written
+    ERROR_T WriteDirtyBitMap();
+
+    // WriteDirtyBitMap, and then makes the file durable if it wrote any
+    ERROR_T SyncBitMap();
+
+    ERROR_T MapDataFile();
+
+    void UnmapDataFile();
+
+    // Extends the file to hold every block, so reads never hit EOF
+    ERROR_T PreallocateDataFile(const int fd);
+
+    ERROR_T OpenDataFd(const bool direct);
+
+    void CloseDataFd();
+
+    // Makes directbuf hold at least n blocks
+    ERROR_T ReserveDirectBuffer(const SIZE_T n);
+
+    // Moves numblock blocks from inoffblock on between the data file and
+    // iov, by whichever backend is in use
+    ERROR_T Transfer(const bool write, const SIZE_T inoffblock, const SIZE_T numblock, const struct iovec *iov,
+                     const int iovcnt);
+
+    SIZE_T GetNumBitmapWords() const { return (numblocks + 63) / 64; }
+
+    // Sets or clears the bits of blocks first to first+n-1
+    void SetBitmapRange(const SIZE_T first, const SIZE_T n, const bool allocated);
+
+    // The first maximal run of free blocks starting at or after from and
+    // ending by end, if there is one
+    bool NextFreeExtent(const SIZE_T from, const SIZE_T end, SIZE_T &start, SIZE_T &len) const;
+
 
 public:
     // The data is stored in file "filestem.data"
@@ -78,8 +146,79 @@ public:
 
     virtual ~DiskSystem();
 
+    // A striped disk if filestem has a stripe layout, a flash device if
+    // its config names a model, a rotating disk otherwise; null if its
+    // files can't be read or the layout or model is unusable
+    static DiskSystem *Open(const string &filestem);
+
+    // Whether the files could be read, or made
+    virtual bool IsReady() const { return opened; }
+
+    // Switches how the data file is accessed.  The timing model is the
+    // same whichever is used, so only wall-clock time changes.
+    // DISK_DIRECT needs the offset and block size to be multiples of the
+    // sector size (512 bytes) and a file system that supports it.
+    virtual ERROR_T SetBackend(const DiskBackend backend);
+
+    DiskBackend GetBackend() const { return backend; }
+
+    const char *GetBackendName() const;
+
+    // Accepts stdio, mmap, pread, and direct
+    // returns ERROR_NOERROR or ERROR_BADCONFIG
+    static ERROR_T ParseBackend(const string &name, DiskBackend &backend);
+
+    // Makes what has been written durable in the file, along with the
+    // allocations since the last Sync.  That costs a bitmap page for
+    // each 32768 blocks the allocations touched.
+    virtual ERROR_T Sync();
+
+    // Asynchronous I/O on the data file, under DISK_PREAD or DISK_DIRECT.
+    // Up to queuedepth requests are in flight at once, through io_uring,
+    // or a pool of threads if threads is set or io_uring is unavailable.
+    // Changing the backend stops it.
+    ERROR_T StartAsync(const SIZE_T queuedepth, const bool threads = false);
+
+    // Waits out whatever is in flight
+    void StopAsync();
+
+    // io_uring, threads, or none
+    const char *GetAsyncEngineName() const;
+
+    // Like Read and Write, except that the bytes go straight between the
+    // file and buf, which has to stay put until Wait or Poll hands back
+    // tag (and be sector aligned under DISK_DIRECT).  reqtime is the
+    // modeled time, as for the others; the model still sees one request
+    // at a time, in the order they are submitted.
+    ERROR_T SubmitRead(const SIZE_T inoffblock, const SIZE_T numblock, BYTE_T *buf,
+                       const unsigned long long tag, double &reqtime);
+
+    ERROR_T SubmitWrite(const SIZE_T inoffblock, const SIZE_T numblock, const BYTE_T *buf,
+                        const unsigned long long tag, double &reqtime);
+
+    // Collects completed requests, blocking until at least min are done
+    ERROR_T Wait(vector <IOCompletion> &done, const SIZE_T min = 1);
+
+    // Collects completed requests without blocking; returns how many
+    SIZE_T Poll(vector <IOCompletion> &done);
+
     // Each returns the number of milliseconds the operation has taken
 
+    // The blocks go straight between the file and the caller's memory,
+    // iovcnt pieces that hold the numblock blocks in order, however they
+    // are cut.  With a descriptor that is one preadv or pwritev.
+    virtual ERROR_T Read(const SIZE_T inoffblock, const SIZE_T numblock, const struct iovec *iov, const int iovcnt,
+                         double &reqtime);
+
+    virtual ERROR_T Write(const SIZE_T inoffblock, const SIZE_T numblock, const struct iovec *iov, const int iovcnt,
+                          double &reqtime);
+
+    // The same with numblock blocks side by side at buf
+    ERROR_T Read(const SIZE_T inoffblock, const SIZE_T numblock, BYTE_T *buf, double &reqtime);
+
+    ERROR_T Write(const SIZE_T inoffblock, const SIZE_T numblock, const BYTE_T *buf, double &reqtime);
+
+    // Appends the blocks read to blocks
     ERROR_T Read(const SIZE_T inoffblock, const SIZE_T numblock, vector <Block> &blocks, double &reqtime);
 
     ERROR_T Read(const SIZE_T inoffblock, Block &blocks, double &reqtime);
@@ -88,10 +227,25 @@ public:
 
     ERROR_T Write(const SIZE_T inoffblock, const Block &blocks, double &reqtime);
 
+    // Queues the request just read or written, num blocks from off,
+    // issued at issuetime and taking reqtime on its own, behind those
+    // queued before it; returns the simulated time it finishes
+    virtual double ScheduleRequest(const SIZE_T off, const SIZE_T num, const bool write, const double issuetime,
+                                   const double reqtime);
+
+    // Forgets the queue, for a new simulated clock
+    virtual void ResetSchedule();
+
     SIZE_T GetBlockSize() const;
 
     SIZE_T GetNumBlocks() const;
 
+    // Files that go with the disk are named after this
+    const string &GetFileStem() const;
+
+    // The block the last request ended on, for ordering requests
+    virtual SIZE_T GetHeadPosition() const;
+
     //
     // These are notification functions that should be called when
     // a block is allocated or deallocated.  They keep the bitmap updated
@@ -103,6 +257,200 @@ public:
 
     bool IsBlockAllocated(const SIZE_T offset);
 
+    // How many of blocks first to first+n-1 are allocated
+    SIZE_T CountAllocatedBlocks(const SIZE_T first, const SIZE_T n) const;
+
+    // Finds n contiguous free blocks, the first run at or after hint,
+    // wrapping around to the start of the disk
+    // returns ERROR_NOERROR or ERROR_NOSPACE
+    ERROR_T FindFreeRun(const SIZE_T n, const SIZE_T hint, SIZE_T &first) const;
+
+    // The free blocks, how many runs they fall into, and the longest run
+    void GetFreeSpaceSummary(SIZE_T &numfree, SIZE_T &numextents, SIZE_T &largest) const;
+
+
+    virtual ostream &Print(ostream &os) const;
+};
+
+
+//
+// Stripes blocks over several member disks, stripeblocks at a time:
+// block b lives on member (b / stripeblocks) % K, each member with its
+// own data file and head.  The array's own config and bitmap do the
+// allocation.  filestem.stripes holds the layout and the members are
+// filestem.0, filestem.1, ...
+//
+// A request keeps each member it touches busy for that member's modeled
+// time, so requests, or parts of one, on different members overlap.
+//
+class StripedDiskSystem : public DiskSystem {
+private:
+    SIZE_T stripeblocks;
+    vector <DiskSystem *> members;
+    vector <pair<SIZE_T, double> > lastparts;   // (member, time) of the last request
+    SIZE_T lastblock;
+
+    // Member m's share of [off, off + num), as a run of member blocks
+    void MemberRange(const SIZE_T m, const SIZE_T off, const SIZE_T num, SIZE_T &first, SIZE_T &count) const;
+
+    // Cuts the memory of a request starting at block off into each
+    // member's pieces, in the order of its blocks
+    void SplitIov(const SIZE_T off, const struct iovec *iov, const int iovcnt,
+                  vector<vector<struct iovec> > &parts) const;
+
+public:
+    StripedDiskSystem(const string &filestem);
+
+    ~StripedDiskSystem();
+
+    // Makes an array of nummembers disks with the given geometry between
+    // them; each member gets tracks / nummembers of the tracks
+    static ERROR_T Create(const string &filestem, const SIZE_T nummembers, const SIZE_T stripeblocks,
+                          const SIZE_T blocks, const SIZE_T blocksize, const SIZE_T heads,
+                          const SIZE_T blockspertrack, const SIZE_T tracks, const double avgseek,
+                          const double trackseek, const double rotlat);
+
+    // Whether the layout and every member could be read
+    bool IsReady() const { return DiskSystem::IsReady() && !members.empty(); }
+
+    SIZE_T GetNumMembers() const { return members.size(); }
+
+    SIZE_T GetStripeBlocks() const { return stripeblocks; }
+
+    ERROR_T SetBackend(const DiskBackend backend);
+
+    ERROR_T Sync();
+
+    using DiskSystem::Read;
+    using DiskSystem::Write;
+
+    ERROR_T Read(const SIZE_T inoffblock, const SIZE_T numblock, const struct iovec *iov, const int iovcnt,
+                 double &reqtime);
+
+    ERROR_T Write(const SIZE_T inoffblock, const SIZE_T numblock, const struct iovec *iov, const int iovcnt,
+                  double &reqtime);
+
+    double ScheduleRequest(const SIZE_T off, const SIZE_T num, const bool write, const double issuetime,
+                           const double reqtime);
+
+    void ResetSchedule();
+
+    SIZE_T GetHeadPosition() const;
+
+    ostream &Print(ostream &os) const;
+};
+
+// What a flash device is made of and how long its parts take, in
+// milliseconds and megabytes per second
+struct FlashParams {
+    SIZE_T pagesize;            // bytes the device maps, reads and programs at a time
+    SIZE_T channels;
+    SIZE_T diesperchannel;      // each die reads, programs and erases on its own
+    double readlatency;         // a page from the array into the die's register
+    double programlatency;
+    double eraselatency;
+    SIZE_T pagesperblock;       // pages per erase block
+    double overprovision;       // spare pages, as a fraction of the logical ones
+    double commandlatency;      // per request, in the host and controller
+    double channelbandwidth;    // between a die and the controller
+    double hostbandwidth;       // over the link to the host
+    SIZE_T queuedepth;          // requests the device works on at once
+};
+
+
+//
+// An SSD or NVMe drive.  Logical pages are interleaved over the dies,
+// channel by channel.  A request costs the command latency and its
+// transfer over the host link, and on each die it touches, a read or
+// program per page plus moving the page over the die's channel.  A
+// write that covers only part of a page reads the rest first.
+//
+// Once as many pages have been programmed as the device has, including
+// the spare ones, every write also pays for garbage collection: with
+// greedy cleaning under random overwrites, the write amplification is
+// (1 + op) / (2 op) for overprovisioning op, so each page written moves
+// WA - 1 others on its die and costs WA / pagesperblock erases.  The
+// count of pages programmed is kept in the config, so a device stays
+// worn in from run to run.
+//
+// Dies, channels and the link are each busy until their share of the
+// queued requests is done, and at most queuedepth requests are in the
+// device at once, so latency grows with the queue depth.
+//
+// filestem.config names the model (ssd or nvme) after the usual fields,
+// then the parameters, which can be edited there.
+//
+class FlashDiskSystem : public DiskSystem {
+private:
+    struct DiePart {
+        SIZE_T die;
+        double nandtime;        // reads, programs, and collection
+        double transfertime;    // over the channel
+    };
+
+    string model;
+    FlashParams params;
+    bool ready;
+    double pageswritten;        // over the device's life
+    double hostpages;           // pages programmed for the host this session
+    double gcpages;             // and moved by garbage collection
+    double erases;
+    vector <double> diebusy;
+    vector <double> channelbusy;
+    double linkbusy;
+    multiset <double> inside;   // finish times of the requests in the device
+    SIZE_T lastblock;
+
+    SIZE_T GetNumDies() const { return params.channels * params.diesperchannel; }
+
+    // Of garbage collection, 1 until the device has been written over
+    double GetWriteAmplification(const double written) const;
+
+    double GetWriteAmplification() const { return GetWriteAmplification(pageswritten); }
+
+    // How many pages the num blocks from off fall on
+    unsigned long long GetNumPages(const SIZE_T off, const SIZE_T num) const;
+
+    // Writes the model and its state back to where the config keeps it
+    void SaveModelConfig();
+
+    // What the request of num blocks from off costs each die it touches,
+    // with write amplification wa, and how long it spends on the link
+    void SplitRequest(const SIZE_T off, const SIZE_T num, const bool write, const double wa,
+                      vector <DiePart> &parts, double &linktime) const;
+
+protected:
+    double ModelAccess(const SIZE_T off, const SIZE_T num, const bool write);
+
+public:
+    FlashDiskSystem(const string &filestem);
+
+    ~FlashDiskSystem();
+
+    // The parameters ssd or nvme start out with
+    // returns ERROR_NOERROR or ERROR_BADCONFIG
+    static ERROR_T GetPreset(const string &model, FlashParams &params);
+
+    // Makes a device of one of the presets.  The rotating disk's fields
+    // in the config are placeholders.
+    static ERROR_T Create(const string &filestem, const SIZE_T blocks, const SIZE_T blocksize,
+                          const string &model);
+
+    // Whether the config held a model and parameters that make sense
+    bool IsReady() const { return DiskSystem::IsReady() && ready; }
+
+    const string &GetModel() const { return model; }
+
+    const FlashParams &GetParams() const { return params; }
+
+    // Works out the request's share of each die from where it falls,
+    // so reqtime goes unused
+    double ScheduleRequest(const SIZE_T off, const SIZE_T num, const bool write, const double issuetime,
+                           const double);
+
+    void ResetSchedule();
+
+    SIZE_T GetHeadPosition() const;
 
     ostream &Print(ostream &os) const;
 };
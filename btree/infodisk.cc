@@ -5,20 +5,35 @@
 
 
 void usage() {
-    cerr << "usage: infodisk filestem\n";
+    cerr << "usage: infodisk filestem [-summary]\n";
+    cerr << "  -summary leaves out the block by block bitmap\n";
 }
 
 int main(int argc, char *argv[]) {
-#if 0
-    if (argc<2) {
-      usage();
-      exit(-1);
+    if (argc < 2 || (argc > 2 && string(argv[2]) != "-summary") || argc > 3) {
+        usage();
+        exit(-1);
     }
-#endif
+    bool summary = argc > 2;
 
-    DiskSystem disk(argv[1]);
+    DiskSystem *disk = DiskSystem::Open(argv[1]);
 
-    cerr << "Disk is as follows.\n" << disk << "\n";
+    if (!disk) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    if (!summary) {
+        cerr << "Disk is as follows.\n" << *disk << "\n";
+    }
+
+    SIZE_T numfree, numextents, largest;
+    disk->GetFreeSpaceSummary(numfree, numextents, largest);
+    cerr << "blocks      = " << disk->GetNumBlocks() << endl;
+    cerr << "allocated   = " << disk->GetNumBlocks() - numfree << endl;
+    cerr << "free        = " << numfree << endl;
+    cerr << "freeextents = " << numextents << endl;
+    cerr << "largestfree = " << largest << endl;
+    delete disk;
 
     cerr << "Done.\n";
 
@@ -0,0 +1,141 @@
+#include <string>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <memory>
+
+#include "disksystem.h"
+
+
+void usage() {
+    cerr << "usage: iobench filestem [-requests n] [-depth n] [-backend pread|direct] [-threads]\n";
+    cerr << "  measures random single block reads of the disk's data file through the\n";
+    cerr << "  asynchronous interface, first one at a time and then with n (default 32)\n";
+    cerr << "  in flight.  Use a data file larger than memory, or -backend direct, to\n";
+    cerr << "  see the device rather than the page cache.  -threads uses the thread\n";
+    cerr << "  pool instead of io_uring.\n";
+}
+
+static double now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+// Reads numrequests random blocks keeping depth in flight
+static ERROR_T run(DiskSystem &disk, const SIZE_T depth, const bool threads, const SIZE_T numrequests,
+                   unsigned seed, double &elapsed) {
+    SIZE_T blocksize = disk.GetBlockSize();
+    vector<SIZE_T> idle;
+    vector<IOCompletion> done;
+    SIZE_T submitted = 0, completed = 0;
+    double reqtime;
+    ERROR_T rc;
+    void *p;
+
+    // sector aligned, for O_DIRECT
+    if (posix_memalign(&p, 4096, (size_t) depth * blocksize) != 0) {
+        return ERROR_NOMEM;
+    }
+    BYTE_T *bufs = (BYTE_T *) p;
+    for (SIZE_T i = 0; i < depth; i++) {
+        idle.push_back(i);
+    }
+    if ((rc = disk.StartAsync(depth, threads)) != ERROR_NOERROR) {
+        free(bufs);
+        return rc;
+    }
+
+    double start = now_us();
+    while (rc == ERROR_NOERROR && completed < numrequests) {
+        while (rc == ERROR_NOERROR && !idle.empty() && submitted < numrequests) {
+            SIZE_T b = rand_r(&seed) % disk.GetNumBlocks();
+            rc = disk.SubmitRead(b, 1, bufs + (size_t) idle.back() * blocksize, idle.back(), reqtime);
+            idle.pop_back();
+            submitted++;
+        }
+        done.clear();
+        if (rc != ERROR_NOERROR || (rc = disk.Wait(done, 1)) != ERROR_NOERROR) {
+            break;
+        }
+        for (SIZE_T i = 0; i < done.size(); i++) {
+            if (done[i].rc != ERROR_NOERROR) {
+                rc = done[i].rc;
+            }
+            idle.push_back(done[i].tag);
+        }
+        completed += done.size();
+    }
+    elapsed = now_us() - start;
+
+    // Waits out anything still in flight before the buffers go
+    disk.StopAsync();
+    free(bufs);
+    return rc;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        usage();
+        exit(-1);
+    }
+    SIZE_T numrequests = 20000;
+    SIZE_T depth = 32;
+    DiskBackend backend = DISK_PREAD;
+    bool threads = false;
+
+    for (int i = 2; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "-requests" && i + 1 < argc) {
+            numrequests = atoi(argv[++i]);
+        } else if (opt == "-depth" && i + 1 < argc) {
+            depth = atoi(argv[++i]);
+        } else if (opt == "-backend" && i + 1 < argc) {
+            if (DiskSystem::ParseBackend(argv[++i], backend) != ERROR_NOERROR
+                || (backend != DISK_PREAD && backend != DISK_DIRECT)) {
+                usage();
+                exit(-1);
+            }
+        } else if (opt == "-threads") {
+            threads = true;
+        } else {
+            usage();
+            exit(-1);
+        }
+    }
+    if (numrequests < 1 || depth < 1) {
+        usage();
+        exit(-1);
+    }
+
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(argv[1]));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
+    ERROR_T rc;
+
+    if ((rc = disk.SetBackend(backend)) != ERROR_NOERROR) {
+        cerr << "Can't set up the disk backend due to error " << rc << endl;
+        return -1;
+    }
+    if ((rc = disk.StartAsync(1, threads)) != ERROR_NOERROR) {
+        cerr << "Can't start asynchronous I/O due to error " << rc << endl;
+        return -1;
+    }
+    cerr << "backend = " << disk.GetBackendName() << endl;
+    cerr << "engine  = " << disk.GetAsyncEngineName() << endl;
+    disk.StopAsync();
+
+    cerr << "depth\tus/read\treads/s\n";
+    SIZE_T depths[2] = { 1, depth };
+    for (SIZE_T i = 0; i < 2; i++) {
+        double elapsed;
+        if ((rc = run(disk, depths[i], threads, numrequests, 1, elapsed)) != ERROR_NOERROR) {
+            cerr << "Reads failed due to error " << rc << endl;
+            return -1;
+        }
+        cerr << depths[i] << "\t" << elapsed / numrequests << "\t" << numrequests / (elapsed / 1e6) << endl;
+    }
+    return 0;
+}
@@ -5,17 +5,52 @@
 
 
 void usage() {
-    cerr << "usage: makedisk filestem blocks blocksize heads blockspertrack tracks avgseek trackseek rotlat\n";
+    cerr << "usage: makedisk filestem blocks blocksize heads blockspertrack tracks avgseek trackseek rotlat"
+    << " [-stripes members stripeblocks]\n";
+    cerr << "  -stripes makes an array of that many disks, the tracks split evenly between\n";
+    cerr << "  them, with blocks striped over them stripeblocks at a time\n";
+    cerr << "       makedisk filestem blocks blocksize -flash ssd|nvme\n";
+    cerr << "  makes a flash device; its parameters are in filestem.config\n";
 }
 
 int main(int argc, char *argv[]) {
-    if (argc < 10) {
+    if (argc == 6 && string(argv[4]) == "-flash") {
+        ERROR_T rc = FlashDiskSystem::Create(argv[1], atoi(argv[2]), atoi(argv[3]), argv[5]);
+        if (rc != ERROR_NOERROR) {
+            cerr << "Can't make the device due to error " << rc << endl;
+            return -1;
+        }
+        FlashDiskSystem disk(argv[1]);
+        cerr << "Disk is as follows.\n" << disk << "\n";
+        cerr << "Done.\n";
+        return 0;
+    }
+
+    if (argc < 10 || (argc > 10 && (argc != 13 || string(argv[10]) != "-stripes"))) {
         usage();
         exit(-1);
     }
 
+    if (argc == 13) {
+        ERROR_T rc = StripedDiskSystem::Create(argv[1], atoi(argv[11]), atoi(argv[12]), atoi(argv[2]), atoi(argv[3]),
+                                               atoi(argv[4]), atoi(argv[5]), atoi(argv[6]), atof(argv[7]),
+                                               atof(argv[8]), atof(argv[9]));
+        if (rc != ERROR_NOERROR) {
+            cerr << "Can't make the array due to error " << rc << endl;
+            return -1;
+        }
+        StripedDiskSystem disk(argv[1]);
+        cerr << "Disk is as follows.\n" << disk << "\n";
+        cerr << "Done.\n";
+        return 0;
+    }
+
     DiskSystem disk(argv[1], true, 0, atoi(argv[2]), atoi(argv[3]), atoi(argv[4]), atoi(argv[5]), atoi(argv[6]),
                     atof(argv[7]), atof(argv[8]), atof(argv[9]));
+    if (!disk.IsReady()) {
+        cerr << "Can't make the disk\n";
+        return -1;
+    }
 
     cerr << "Disk is as follows.\n" << disk << "\n";
     cerr << "Done.\n";
@@ -0,0 +1,144 @@
+#include <string>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <pthread.h>
+#include <memory>
+
+#include "buffercache.h"
+
+
+void usage() {
+    cerr << "usage: mtbench filestem cachesize [-shards n] [-threads max] [-blocks n] [-ops n]\n";
+    cerr << "  measures buffer cache read throughput with 1, 2, 4, ..., max threads\n";
+    cerr << "  pinning random blocks out of the first n (default cachesize), once\n";
+    cerr << "  with a single shard and once with -shards shards (default 16).\n";
+    cerr << "  -ops is the number of reads each thread does (default 200000).\n";
+}
+
+static double now_us() {
+    struct timeval tv;
+    gettimeofday(&tv, 0);
+    return tv.tv_sec * 1e6 + tv.tv_usec;
+}
+
+struct ReaderArgs {
+    BufferCache *cache;
+    SIZE_T numblocks;
+    SIZE_T numops;
+    unsigned seed;
+    ERROR_T rc;
+    SIZE_T sum;
+};
+
+static void *reader(void *arg) {
+    ReaderArgs *a = (ReaderArgs *) arg;
+    BlockHandle h;
+
+    a->rc = ERROR_NOERROR;
+    a->sum = 0;
+    for (SIZE_T i = 0; i < a->numops; i++) {
+        SIZE_T b = rand_r(&a->seed) % a->numblocks;
+        if ((a->rc = a->cache->PinBlock(b, h)) != ERROR_NOERROR) {
+            return 0;
+        }
+        a->sum += h.data[0];
+        a->cache->UnpinBlock(h, false);
+    }
+    return 0;
+}
+
+// Returns reads per microsecond, or a negative number on error
+static double run(DiskSystem &disk, const SIZE_T cachesize, const SIZE_T numshards,
+                  const SIZE_T numthreads, const SIZE_T numblocks, const SIZE_T numops) {
+    BufferCache cache(&disk, cachesize, REPLACEMENT_LRU, false, numshards);
+    vector<ReaderArgs> args(numthreads);
+    vector<pthread_t> threads(numthreads);
+    Block block;
+
+    cache.Attach();
+
+    // Warm up so that a working set that fits measures hits
+    for (SIZE_T i = 0; i < numblocks && i < cachesize; i++) {
+        cache.ReadBlock(i, block);
+    }
+
+    double start = now_us();
+    for (SIZE_T t = 0; t < numthreads; t++) {
+        args[t].cache = &cache;
+        args[t].numblocks = numblocks;
+        args[t].numops = numops;
+        args[t].seed = t + 1;
+        pthread_create(&threads[t], 0, reader, &args[t]);
+    }
+    for (SIZE_T t = 0; t < numthreads; t++) {
+        pthread_join(threads[t], 0);
+    }
+    double elapsed = now_us() - start;
+
+    for (SIZE_T t = 0; t < numthreads; t++) {
+        if (args[t].rc != ERROR_NOERROR) {
+            cerr << "Error " << args[t].rc << " occured in thread " << t << endl;
+            return -1;
+        }
+    }
+    cache.Detach();
+    return numthreads * numops / elapsed;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage();
+        exit(-1);
+    }
+    SIZE_T cachesize = atoi(argv[2]);
+    SIZE_T numshards = 16;
+    SIZE_T maxthreads = 16;
+    SIZE_T numblocks = cachesize;
+    SIZE_T numops = 200000;
+
+    for (int i = 3; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "-shards" && i + 1 < argc) {
+            numshards = atoi(argv[++i]);
+        } else if (opt == "-threads" && i + 1 < argc) {
+            maxthreads = atoi(argv[++i]);
+        } else if (opt == "-blocks" && i + 1 < argc) {
+            numblocks = atoi(argv[++i]);
+        } else if (opt == "-ops" && i + 1 < argc) {
+            numops = atoi(argv[++i]);
+        } else {
+            usage();
+            exit(-1);
+        }
+    }
+
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(argv[1]));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
+
+    if (numblocks < 1 || disk.GetNumBlocks() < numblocks) {
+        cerr << "Disk has only " << disk.GetNumBlocks() << " blocks, need " << numblocks << endl;
+        return -1;
+    }
+
+    cerr << "threads\t1 shard Mreads/s\tspeedup\t" << numshards << " shards Mreads/s\tspeedup\n";
+
+    double base1 = 0, basen = 0;
+    for (SIZE_T t = 1; t <= maxthreads; t *= 2) {
+        double r1 = run(disk, cachesize, 1, t, numblocks, numops);
+        double rn = run(disk, cachesize, numshards, t, numblocks, numops);
+        if (r1 < 0 || rn < 0) {
+            return -1;
+        }
+        if (t == 1) {
+            base1 = r1;
+            basen = rn;
+        }
+        cerr << t << "\t" << r1 << "\t" << r1 / base1 << "\t" << rn << "\t" << rn / basen << endl;
+    }
+
+    return 0;
+}
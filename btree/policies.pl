@@ -0,0 +1,26 @@
+#!/usr/bin/perl -w
+
+# Replays the same sim request file under each replacement policy
+# and prints hit ratio, disk traffic, and simulated time side by side
+
+$#ARGV == 2 or die "usage: policies.pl filestem cachesize simrequests\n";
+
+($filestem, $cachesize, $requests) = @ARGV;
+
+$ENV{PATH} .= ":.";
+
+printf "%-8s %10s %12s %12s %14s\n", "policy", "hitratio", "diskreads", "diskwrites", "time";
+
+foreach $policy ("lru", "clock", "2q", "arc", "lru2") {
+    my %stat;
+    open(SIM, "sim $filestem $cachesize -policy $policy < $requests 2>&1 >/dev/null |")
+        or die "can't run sim\n";
+    while (<SIM>) {
+        if (/^(\w[\w ]*?)\s*=\s*(\S+)/) {
+            $stat{$1} = $2;
+        }
+    }
+    close(SIM);
+    printf "%-8s %10.4f %12d %12d %14.2f\n", $policy, $stat{"hitratio"},
+        $stat{"numdiskreads"}, $stat{"numdiskwrites"}, $stat{"total time"};
+}
@@ -1,11 +1,14 @@
 #include <string>
 #include <stdlib.h>
+#include <memory>
 
 #include "buffercache.h"
 
 
 void usage() {
-    cerr << "usage: readbuffer cachesize filestem blocknum numblocks > data\n";
+    cerr << "usage: readbuffer cachesize filestem blocknum numblocks [-readahead n] > data\n";
+    cerr << "  with -readahead the cache detects the sequential scan by itself,\n";
+    cerr << "  otherwise each block is prefetched while the one before it is output\n";
 }
 
 int main(int argc, char *argv[]) {
@@ -16,18 +19,37 @@ int main(int argc, char *argv[]) {
     SIZE_T cachesize = atoi(argv[1]);
     SIZE_T blocknum = atoi(argv[3]);
     SIZE_T numblocks = atoi(argv[4]);
+    SIZE_T readahead = 0;
 
-    DiskSystem disk(argv[2]);
+    if (argc > 5) {
+        if (argc != 7 || string(argv[5]) != "-readahead") {
+            usage();
+            exit(-1);
+        }
+        readahead = atoi(argv[6]);
+    }
+
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(argv[2]));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
     BufferCache cache(&disk, cachesize);
 
     SIZE_T blocksize = disk.GetBlockSize();
 
     cache.Attach();
+    cache.SetReadahead(readahead);
 
     for (unsigned i = blocknum; i < (blocknum + numblocks); i++) {
         Block block(blocksize);
         ERROR_T rc;
-        rc = cache.ReadBlock(i, block);
+        if (readahead == 0 && i + 1 < blocknum + numblocks) {
+            // overlap reading the next block with writing out this one
+            cache.PrefetchBlock(i + 1);
+        }
+        rc = cache.ReadBlock(i, block, ACCESS_SCAN);
         if (rc != ERROR_NOERROR) {
             cerr << "Error " << rc << " occured when reading block " << i << endl;
             return -1;
@@ -45,11 +67,17 @@ int main(int argc, char *argv[]) {
     cerr << "numdeallocs     = " << cache.GetNumDeallocs() << endl;
     cerr << "numreads        = " << cache.GetNumReads() << endl;
     cerr << "numdiskreads    = " << cache.GetNumDiskReads() << endl;
+    cerr << "numprefetches   = " << cache.GetNumPrefetches() << endl;
+    cerr << "numprefetchhits = " << cache.GetNumPrefetchHits() << endl;
+    cerr << "numreadaheads   = " << cache.GetNumReadaheads() << endl;
+    cerr << "numreadaheadhits= " << cache.GetNumReadaheadHits() << endl;
+    cerr << "numdiskreadreqs = " << cache.GetNumDiskReadRequests() << endl;
     cerr << "numwrites       = " << cache.GetNumWrites() << endl;
     cerr << "numdiskwrites   = " << cache.GetNumDiskWrites() << endl;
     cerr << endl;
 
     cerr << "total time      = " << cache.GetCurrentTime() << endl;
+    cerr << "stall time      = " << cache.GetStallTime() << endl;
 
     return 0;
 }
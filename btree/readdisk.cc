@@ -1,5 +1,6 @@
 #include <string>
 #include <stdlib.h>
+#include <memory>
 
 #include "disksystem.h"
 
@@ -17,7 +18,12 @@ int main(int argc, char *argv[]) {
     SIZE_T numblocks = atoi(argv[3]);
     double reqtime;
 
-    DiskSystem disk(argv[1]);
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(argv[1]));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
 
     vector <Block> b;
 
@@ -0,0 +1,516 @@
+#include "replacementpolicy.h"
+
+
+BufferFrame::BufferFrame(const SIZE_T b) : data(0), snapshot(0) {
+    Reset(b);
+}
+
+void BufferFrame::Reset(const SIZE_T b) {
+    blocknum = b;
+    dirty = false;
+    dirtyseq = 0;
+    prev = next = 0;
+    queue = 0;
+    referenced = false;
+    lastaccess = prevaccess = 0;
+    inflight = false;
+    prefetched = false;
+    readahead = false;
+    scanring = false;
+    retained = false;
+    readytime = 0;
+    pincount = 0;
+    sharedlatches = 0;
+    exclusivelatch = false;
+}
+
+
+void FrameList::PushFront(BufferFrame *f) {
+    f->prev = 0;
+    f->next = front;
+    if (front) {
+        front->prev = f;
+    } else {
+        back = f;
+    }
+    front = f;
+    size++;
+}
+
+void FrameList::InsertBefore(BufferFrame *pos, BufferFrame *f) {
+    if (!pos) {
+        f->next = 0;
+        f->prev = back;
+        if (back) {
+            back->next = f;
+        } else {
+            front = f;
+        }
+        back = f;
+        size++;
+    } else if (pos == front) {
+        PushFront(f);
+    } else {
+        f->next = pos;
+        f->prev = pos->prev;
+        pos->prev->next = f;
+        pos->prev = f;
+        size++;
+    }
+}
+
+void FrameList::Remove(BufferFrame *f) {
+    if (f->prev) {
+        f->prev->next = f->next;
+    } else {
+        front = f->next;
+    }
+    if (f->next) {
+        f->next->prev = f->prev;
+    } else {
+        back = f->prev;
+    }
+    f->prev = f->next = 0;
+    size--;
+}
+
+void FrameList::Replace(BufferFrame *old, BufferFrame *f) {
+    if (f->prev) {
+        f->prev->next = f;
+    } else {
+        front = f;
+    }
+    if (f->next) {
+        f->next->prev = f;
+    } else {
+        back = f;
+    }
+    old->prev = old->next = 0;
+}
+
+BufferFrame *FrameList::LastEvictable() const {
+    BufferFrame *f = back;
+    while (f && !f->IsEvictable()) {
+        f = f->prev;
+    }
+    return f;
+}
+
+
+double GhostList::GetValue(const SIZE_T blocknum) const {
+    unordered_map<SIZE_T, pair<list<SIZE_T>::iterator, double> >::const_iterator e = entries.find(blocknum);
+    return e == entries.end() ? 0 : (*e).second.second;
+}
+
+void GhostList::Add(const SIZE_T blocknum, const double value) {
+    Remove(blocknum);
+    order.push_front(blocknum);
+    entries[blocknum] = make_pair(order.begin(), value);
+}
+
+void GhostList::Remove(const SIZE_T blocknum) {
+    unordered_map<SIZE_T, pair<list<SIZE_T>::iterator, double> >::iterator e = entries.find(blocknum);
+    if (e != entries.end()) {
+        order.erase((*e).second.first);
+        entries.erase(e);
+    }
+}
+
+void GhostList::RemoveOldest() {
+    if (!order.empty()) {
+        entries.erase(order.back());
+        order.pop_back();
+    }
+}
+
+void GhostList::Clear() {
+    order.clear();
+    entries.clear();
+}
+
+
+ReplacementPolicy *ReplacementPolicy::Create(const ReplacementPolicyType type, const SIZE_T capacity) {
+    switch (type) {
+        case REPLACEMENT_CLOCK:
+            return new ClockPolicy(capacity);
+        case REPLACEMENT_2Q:
+            return new TwoQueuePolicy(capacity);
+        case REPLACEMENT_ARC:
+            return new ARCPolicy(capacity);
+        case REPLACEMENT_LRU2:
+            return new LRU2Policy(capacity);
+        case REPLACEMENT_LRU:
+        default:
+            return new LRUPolicy(capacity);
+    }
+}
+
+ERROR_T ReplacementPolicy::ParseType(const string &name, ReplacementPolicyType &type) {
+    if (name == "lru") {
+        type = REPLACEMENT_LRU;
+    } else if (name == "clock") {
+        type = REPLACEMENT_CLOCK;
+    } else if (name == "2q") {
+        type = REPLACEMENT_2Q;
+    } else if (name == "arc") {
+        type = REPLACEMENT_ARC;
+    } else if (name == "lru2") {
+        type = REPLACEMENT_LRU2;
+    } else {
+        return ERROR_BADCONFIG;
+    }
+    return ERROR_NOERROR;
+}
+
+
+//
+// LRU
+//
+
+void LRUPolicy::Insert(BufferFrame *f) {
+    frames.PushFront(f);
+}
+
+void LRUPolicy::InsertLowPriority(BufferFrame *f) {
+    frames.InsertBefore(0, f);
+}
+
+void LRUPolicy::Touch(BufferFrame *f) {
+    if (f != frames.front) {
+        frames.Remove(f);
+        frames.PushFront(f);
+    }
+}
+
+void LRUPolicy::Remove(BufferFrame *f, const bool evicted) {
+    frames.Remove(f);
+}
+
+void LRUPolicy::Replace(BufferFrame *old, BufferFrame *f) {
+    frames.Replace(old, f);
+}
+
+BufferFrame *LRUPolicy::Victim(const SIZE_T incoming) {
+    return frames.LastEvictable();
+}
+
+void LRUPolicy::Clear() {
+    frames.Clear();
+}
+
+
+//
+// CLOCK
+//
+
+void ClockPolicy::Insert(BufferFrame *f) {
+    // New frames go just behind the hand, so they get a full sweep
+    f->referenced = true;
+    frames.InsertBefore(hand, f);
+}
+
+void ClockPolicy::InsertLowPriority(BufferFrame *f) {
+    // Unreferenced and under the hand, so it is the next one looked at
+    f->referenced = false;
+    frames.InsertBefore(hand, f);
+    hand = f;
+}
+
+void ClockPolicy::Touch(BufferFrame *f) {
+    f->referenced = true;
+}
+
+void ClockPolicy::Remove(BufferFrame *f, const bool evicted) {
+    if (f == hand) {
+        hand = f->next;
+    }
+    frames.Remove(f);
+}
+
+void ClockPolicy::Replace(BufferFrame *old, BufferFrame *f) {
+    if (old == hand) {
+        hand = f;
+    }
+    frames.Replace(old, f);
+}
+
+BufferFrame *ClockPolicy::Victim(const SIZE_T incoming) {
+    // Two sweeps clear every reference bit, so anything left is pinned down
+    for (SIZE_T i = 0; i <= 2 * frames.size; i++) {
+        if (!hand) {
+            hand = frames.front;
+            if (!hand) {
+                return 0;
+            }
+        }
+        if (hand->IsEvictable() && !hand->referenced) {
+            return hand;
+        }
+        hand->referenced = false;
+        hand = hand->next;
+    }
+    return 0;
+}
+
+void ClockPolicy::Clear() {
+    frames.Clear();
+    hand = 0;
+}
+
+
+//
+// 2Q
+//
+
+#define TWOQ_A1IN 0
+#define TWOQ_AM 1
+
+TwoQueuePolicy::TwoQueuePolicy(const SIZE_T capacity) : ReplacementPolicy(capacity) {
+    SetCapacity(capacity);
+}
+
+void TwoQueuePolicy::SetCapacity(const SIZE_T c) {
+    capacity = c;
+    // The tuning the 2Q paper recommends
+    kin = capacity / 4 > 0 ? capacity / 4 : 1;
+    kout = capacity / 2 > 0 ? capacity / 2 : 1;
+}
+
+void TwoQueuePolicy::Insert(BufferFrame *f) {
+    if (a1out.Contains(f->blocknum)) {
+        a1out.Remove(f->blocknum);
+        f->queue = TWOQ_AM;
+        am.PushFront(f);
+    } else {
+        f->queue = TWOQ_A1IN;
+        a1in.PushFront(f);
+    }
+}
+
+void TwoQueuePolicy::InsertLowPriority(BufferFrame *f) {
+    f->queue = TWOQ_A1IN;
+    a1in.InsertBefore(0, f);
+}
+
+void TwoQueuePolicy::Touch(BufferFrame *f) {
+    // Hits in A1in are correlated references and don't promote
+    if (f->queue == TWOQ_AM && f != am.front) {
+        am.Remove(f);
+        am.PushFront(f);
+    }
+}
+
+void TwoQueuePolicy::Remove(BufferFrame *f, const bool evicted) {
+    if (f->queue == TWOQ_AM) {
+        am.Remove(f);
+    } else {
+        a1in.Remove(f);
+        if (evicted) {
+            a1out.Add(f->blocknum);
+            while (a1out.Size() > kout) {
+                a1out.RemoveOldest();
+            }
+        }
+    }
+}
+
+void TwoQueuePolicy::Replace(BufferFrame *old, BufferFrame *f) {
+    (f->queue == TWOQ_AM ? am : a1in).Replace(old, f);
+}
+
+BufferFrame *TwoQueuePolicy::Victim(const SIZE_T incoming) {
+    BufferFrame *f;
+    if (a1in.size > kin) {
+        f = a1in.LastEvictable();
+        return f ? f : am.LastEvictable();
+    } else {
+        f = am.LastEvictable();
+        return f ? f : a1in.LastEvictable();
+    }
+}
+
+void TwoQueuePolicy::Clear() {
+    a1in.Clear();
+    am.Clear();
+    a1out.Clear();
+}
+
+
+//
+// ARC
+//
+
+#define ARC_T1 0
+#define ARC_T2 1
+
+void ARCPolicy::Insert(BufferFrame *f) {
+    double b1size = b1.Size(), b2size = b2.Size();
+
+    if (b1.Contains(f->blocknum)) {
+        // Recency list was too short, grow its target
+        target += b1size >= b2size ? 1 : b2size / b1size;
+        if (target > capacity) {
+            target = capacity;
+        }
+        b1.Remove(f->blocknum);
+        f->queue = ARC_T2;
+        t2.PushFront(f);
+    } else if (b2.Contains(f->blocknum)) {
+        // Frequency list was too short, shrink the recency target
+        target -= b2size >= b1size ? 1 : b1size / b2size;
+        if (target < 0) {
+            target = 0;
+        }
+        b2.Remove(f->blocknum);
+        f->queue = ARC_T2;
+        t2.PushFront(f);
+    } else {
+        f->queue = ARC_T1;
+        t1.PushFront(f);
+    }
+
+    while (t1.size + b1.Size() > capacity && b1.Size() > 0) {
+        b1.RemoveOldest();
+    }
+    while (t1.size + t2.size + b1.Size() + b2.Size() > 2 * capacity && b2.Size() > 0) {
+        b2.RemoveOldest();
+    }
+}
+
+void ARCPolicy::InsertLowPriority(BufferFrame *f) {
+    f->queue = ARC_T1;
+    t1.InsertBefore(0, f);
+}
+
+void ARCPolicy::Touch(BufferFrame *f) {
+    if (f->queue == ARC_T1) {
+        t1.Remove(f);
+    } else {
+        t2.Remove(f);
+    }
+    f->queue = ARC_T2;
+    t2.PushFront(f);
+}
+
+void ARCPolicy::Remove(BufferFrame *f, const bool evicted) {
+    if (f->queue == ARC_T1) {
+        t1.Remove(f);
+        if (evicted) {
+            b1.Add(f->blocknum);
+        }
+    } else {
+        t2.Remove(f);
+        if (evicted) {
+            b2.Add(f->blocknum);
+        }
+    }
+}
+
+void ARCPolicy::Replace(BufferFrame *old, BufferFrame *f) {
+    (f->queue == ARC_T1 ? t1 : t2).Replace(old, f);
+}
+
+BufferFrame *ARCPolicy::Victim(const SIZE_T incoming) {
+    BufferFrame *f;
+    if (t1.size > 0 && (t1.size > target || (b2.Contains(incoming) && t1.size == target))) {
+        f = t1.LastEvictable();
+        return f ? f : t2.LastEvictable();
+    } else {
+        f = t2.LastEvictable();
+        return f ? f : t1.LastEvictable();
+    }
+}
+
+void ARCPolicy::SetCapacity(const SIZE_T c) {
+    capacity = c;
+    if (target > capacity) {
+        target = capacity;
+    }
+}
+
+void ARCPolicy::Clear() {
+    t1.Clear();
+    t2.Clear();
+    b1.Clear();
+    b2.Clear();
+    target = 0;
+}
+
+
+//
+// LRU-2
+//
+
+#define LRU2_ONCE 0
+#define LRU2_TWICE 1
+
+void LRU2Policy::Insert(BufferFrame *f) {
+    if (history.Contains(f->blocknum)) {
+        // we remember its previous access, so it has a finite distance
+        f->prevaccess = history.GetValue(f->blocknum);
+        history.Remove(f->blocknum);
+        f->queue = LRU2_TWICE;
+        twice.insert(make_pair(f->prevaccess, f));
+    } else {
+        f->queue = LRU2_ONCE;
+        once.PushFront(f);
+    }
+}
+
+void LRU2Policy::InsertLowPriority(BufferFrame *f) {
+    f->queue = LRU2_ONCE;
+    once.InsertBefore(0, f);
+}
+
+void LRU2Policy::Touch(BufferFrame *f) {
+    if (f->queue == LRU2_ONCE) {
+        once.Remove(f);
+    } else {
+        twice.erase(make_pair(f->prevaccess, f));
+    }
+    f->prevaccess = f->lastaccess;
+    f->queue = LRU2_TWICE;
+    twice.insert(make_pair(f->prevaccess, f));
+}
+
+void LRU2Policy::Remove(BufferFrame *f, const bool evicted) {
+    if (f->queue == LRU2_ONCE) {
+        once.Remove(f);
+    } else {
+        twice.erase(make_pair(f->prevaccess, f));
+    }
+    if (evicted) {
+        history.Add(f->blocknum, f->lastaccess);
+        while (history.Size() > capacity) {
+            history.RemoveOldest();
+        }
+    }
+}
+
+void LRU2Policy::Replace(BufferFrame *old, BufferFrame *f) {
+    if (f->queue == LRU2_ONCE) {
+        once.Replace(old, f);
+    } else {
+        twice.erase(make_pair(f->prevaccess, old));
+        twice.insert(make_pair(f->prevaccess, f));
+    }
+}
+
+BufferFrame *LRU2Policy::Victim(const SIZE_T incoming) {
+    BufferFrame *f = once.LastEvictable();
+    if (f) {
+        return f;
+    }
+    for (set<pair<double, BufferFrame *> >::iterator i = twice.begin(); i != twice.end(); ++i) {
+        if ((*i).second->IsEvictable()) {
+            return (*i).second;
+        }
+    }
+    return 0;
+}
+
+void LRU2Policy::Clear() {
+    once.Clear();
+    twice.clear();
+    history.Clear();
+}
@@ -0,0 +1,294 @@
+#ifndef _replacementpolicy
+#define _replacementpolicy
+
+#include <iostream>
+#include <list>
+#include <set>
+#include <string>
+#include <unordered_map>
+
+#include "global.h"
+
+using namespace std;
+
+//
+// A cached block plus the bookkeeping the buffer cache and its
+// replacement policy keep about it
+//
+struct BufferFrame {
+    SIZE_T blocknum;
+    BYTE_T *data;       // this frame's slot in the cache's arena
+    bool dirty;
+    SIZE_T dirtyseq;    // when it last became dirty, for the order writes arrive in
+    BufferFrame *prev;  // links in the policy's queue, front is most recent
+    BufferFrame *next;
+    int queue;          // which of the policy's queues holds the frame
+    bool referenced;    // CLOCK reference bit
+    double lastaccess;  // logical access count of the latest access
+    double prevaccess;  // and of the one before it (LRU-2)
+    bool inflight;      // being read by the prefetcher, contents not valid yet
+    bool prefetched;    // brought in by a prefetch and not yet used
+    bool readahead;     // brought in by readahead at low priority, not yet used
+    bool scanring;      // holds a block read by a scan, recycled by the next ones
+    bool retained;      // an upper level block, kept out of the policy's reach
+    BYTE_T *snapshot;   // the block as the exclusive pin found it, while elision needs it
+    double readytime;   // simulated time at which a prefetch completes
+    SIZE_T pincount;    // outstanding BlockHandles
+    SIZE_T sharedlatches;
+    bool exclusivelatch;
+
+    BufferFrame(const SIZE_T blocknum = 0);
+
+    // Make the frame hold blocknum, keeping its slot
+    void Reset(const SIZE_T blocknum);
+
+    // A frame that is being filled or is pinned can't be given up
+    bool IsEvictable() const { return !inflight && pincount == 0; }
+};
+
+
+//
+// Intrusive doubly-linked list of frames
+//
+struct FrameList {
+    BufferFrame *front;
+    BufferFrame *back;
+    SIZE_T size;
+
+    FrameList() : front(0), back(0), size(0) { }
+
+    void PushFront(BufferFrame *f);
+
+    // Put f just ahead of pos, or at the back if pos is null
+    void InsertBefore(BufferFrame *pos, BufferFrame *f);
+
+    void Remove(BufferFrame *f);
+
+    // f takes old's place; it already has old's links
+    void Replace(BufferFrame *old, BufferFrame *f);
+
+    // The evictable frame closest to the back, or null
+    BufferFrame *LastEvictable() const;
+
+    void Clear() { front = back = 0; size = 0; }
+};
+
+
+//
+// Block numbers (and one value each) remembered after their frames are gone
+// Oldest entries are dropped first
+//
+class GhostList {
+private:
+    list <SIZE_T> order;
+    unordered_map <SIZE_T, pair<list<SIZE_T>::iterator, double> > entries;
+public:
+    bool Contains(const SIZE_T blocknum) const { return entries.find(blocknum) != entries.end(); }
+
+    double GetValue(const SIZE_T blocknum) const;
+
+    void Add(const SIZE_T blocknum, const double value = 0);
+
+    void Remove(const SIZE_T blocknum);
+
+    void RemoveOldest();
+
+    SIZE_T Size() const { return entries.size(); }
+
+    void Clear();
+};
+
+
+enum ReplacementPolicyType {
+    REPLACEMENT_LRU, REPLACEMENT_CLOCK, REPLACEMENT_2Q, REPLACEMENT_ARC, REPLACEMENT_LRU2
+};
+
+
+//
+// Decides which frame the buffer cache gives up when it needs room
+//
+// The cache calls Insert when a frame enters, Touch on every later
+// access (before it updates lastaccess), and Remove when a frame leaves.
+// Speculative frames enter through InsertLowPriority, which puts them
+// next in line for eviction and leaves the policy's history alone.
+// Victim never returns a frame that is not evictable.
+//
+class ReplacementPolicy {
+protected:
+    SIZE_T capacity;
+
+public:
+    ReplacementPolicy(const SIZE_T capacity) : capacity(capacity) { }
+
+    virtual ~ReplacementPolicy() { }
+
+    static ReplacementPolicy *Create(const ReplacementPolicyType type, const SIZE_T capacity);
+
+    // Accepts lru, clock, 2q, arc, and lru2
+    // returns ERROR_NOERROR or ERROR_BADCONFIG
+    static ERROR_T ParseType(const string &name, ReplacementPolicyType &type);
+
+    virtual void Insert(BufferFrame *f) = 0;
+
+    virtual void InsertLowPriority(BufferFrame *f) = 0;
+
+    virtual void Touch(BufferFrame *f) = 0;
+
+    // evicted is false when the frame leaves for another reason (flush, detach)
+    virtual void Remove(BufferFrame *f, const bool evicted) = 0;
+
+    // incoming is the block the room is needed for
+    virtual BufferFrame *Victim(const SIZE_T incoming) = 0;
+
+    // The block in old has moved to f, which carries old's fields
+    virtual void Replace(BufferFrame *old, BufferFrame *f) = 0;
+
+    // The cache grew or shrank; frames over the new capacity are
+    // evicted through Victim as usual
+    virtual void SetCapacity(const SIZE_T c) { capacity = c; }
+
+    // Forget all frames and history
+    virtual void Clear() = 0;
+
+    virtual const char *GetName() const = 0;
+};
+
+
+class LRUPolicy : public ReplacementPolicy {
+private:
+    FrameList frames;
+public:
+    LRUPolicy(const SIZE_T capacity) : ReplacementPolicy(capacity) { }
+
+    void Insert(BufferFrame *f);
+
+    void InsertLowPriority(BufferFrame *f);
+
+    void Touch(BufferFrame *f);
+
+    void Remove(BufferFrame *f, const bool evicted);
+
+    void Replace(BufferFrame *old, BufferFrame *f);
+
+    BufferFrame *Victim(const SIZE_T incoming);
+
+    void Clear();
+
+    const char *GetName() const { return "lru"; }
+};
+
+
+// Second chance: a hand sweeps the frames, clearing reference bits
+class ClockPolicy : public ReplacementPolicy {
+private:
+    FrameList frames;
+    BufferFrame *hand;
+public:
+    ClockPolicy(const SIZE_T capacity) : ReplacementPolicy(capacity), hand(0) { }
+
+    void Insert(BufferFrame *f);
+
+    void InsertLowPriority(BufferFrame *f);
+
+    void Touch(BufferFrame *f);
+
+    void Remove(BufferFrame *f, const bool evicted);
+
+    void Replace(BufferFrame *old, BufferFrame *f);
+
+    BufferFrame *Victim(const SIZE_T incoming);
+
+    void Clear();
+
+    const char *GetName() const { return "clock"; }
+};
+
+
+// Johnson and Shasha's full 2Q: first references go through a FIFO
+// and only blocks referenced again after leaving it reach the LRU queue
+class TwoQueuePolicy : public ReplacementPolicy {
+private:
+    FrameList a1in;
+    FrameList am;
+    GhostList a1out;
+    SIZE_T kin, kout;
+public:
+    TwoQueuePolicy(const SIZE_T capacity);
+
+    void Insert(BufferFrame *f);
+
+    void InsertLowPriority(BufferFrame *f);
+
+    void Touch(BufferFrame *f);
+
+    void Remove(BufferFrame *f, const bool evicted);
+
+    void Replace(BufferFrame *old, BufferFrame *f);
+
+    BufferFrame *Victim(const SIZE_T incoming);
+
+    void SetCapacity(const SIZE_T c);
+
+    void Clear();
+
+    const char *GetName() const { return "2q"; }
+};
+
+
+// Megiddo and Modha's adaptive replacement cache
+class ARCPolicy : public ReplacementPolicy {
+private:
+    FrameList t1, t2;
+    GhostList b1, b2;
+    double target;  // p, the desired size of t1
+public:
+    ARCPolicy(const SIZE_T capacity) : ReplacementPolicy(capacity), target(0) { }
+
+    void Insert(BufferFrame *f);
+
+    void InsertLowPriority(BufferFrame *f);
+
+    void Touch(BufferFrame *f);
+
+    void Remove(BufferFrame *f, const bool evicted);
+
+    void Replace(BufferFrame *old, BufferFrame *f);
+
+    BufferFrame *Victim(const SIZE_T incoming);
+
+    void SetCapacity(const SIZE_T c);
+
+    void Clear();
+
+    const char *GetName() const { return "arc"; }
+};
+
+
+// LRU-K with K=2: evict the block whose second most recent access is
+// oldest.  Blocks seen only once go first, in LRU order.
+class LRU2Policy : public ReplacementPolicy {
+private:
+    FrameList once;
+    set <pair<double, BufferFrame *> > twice;
+    GhostList history;  // last access of recently evicted blocks
+public:
+    LRU2Policy(const SIZE_T capacity) : ReplacementPolicy(capacity) { }
+
+    void Insert(BufferFrame *f);
+
+    void InsertLowPriority(BufferFrame *f);
+
+    void Touch(BufferFrame *f);
+
+    void Remove(BufferFrame *f, const bool evicted);
+
+    void Replace(BufferFrame *old, BufferFrame *f);
+
+    BufferFrame *Victim(const SIZE_T incoming);
+
+    void Clear();
+
+    const char *GetName() const { return "lru2"; }
+};
+
+#endif
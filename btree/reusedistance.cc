@@ -0,0 +1,176 @@
+#include <algorithm>
+
+#include "reusedistance.h"
+
+// Slots the tree starts with, and at least this many free after a compaction
+const SIZE_T MIN_REUSE_SLOTS = 1024;
+// Sampling resolution
+const SIZE_T SAMPLE_MODULUS = 1 << 24;
+
+
+// Murmur3's finalizer, so that nearby block numbers sample independently
+static SIZE_T mix(SIZE_T h) {
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
+    return h;
+}
+
+
+ReuseDistance::ReuseDistance(const double rate) {
+    samplerate = rate > 0 && rate < 1 ? rate : 1;
+    threshold = (SIZE_T) (samplerate * SAMPLE_MODULUS);
+    Clear();
+}
+
+bool ReuseDistance::Sampled(const SIZE_T blocknum) const {
+    return samplerate >= 1 || mix(blocknum) % SAMPLE_MODULUS < threshold;
+}
+
+void ReuseDistance::Clear() {
+    blocks.clear();
+    tree.assign(MIN_REUSE_SLOTS + 1, 0);
+    nextslot = 1;
+    histogram.clear();
+    reads.clear();
+    farreads = 0;
+    writebacks.clear();
+    accesses = cold = coldreads = 0;
+}
+
+void ReuseDistance::Add(SIZE_T slot, const int delta) {
+    for (; slot < tree.size(); slot += slot & -slot) {
+        tree[slot] += delta;
+    }
+}
+
+SIZE_T ReuseDistance::CountUpTo(SIZE_T slot) const {
+    SIZE_T n = 0;
+    for (; slot > 0; slot -= slot & -slot) {
+        n += tree[slot];
+    }
+    return n;
+}
+
+void ReuseDistance::Compact() {
+    vector<pair<SIZE_T, SIZE_T> > live;     // (slot, block), in access order
+
+    live.reserve(blocks.size());
+    for (unordered_map<SIZE_T, Entry>::const_iterator i = blocks.begin(); i != blocks.end(); ++i) {
+        live.push_back(make_pair((*i).second.slot, (*i).first));
+    }
+    sort(live.begin(), live.end());
+
+    SIZE_T size = 2 * live.size() > MIN_REUSE_SLOTS ? 2 * live.size() : MIN_REUSE_SLOTS;
+    tree.assign(size + 1, 0);
+    for (SIZE_T i = 0; i < live.size(); i++) {
+        blocks[live[i].second].slot = i + 1;
+        tree[i + 1] = 1;
+    }
+    // Build the tree bottom up in linear time
+    for (SIZE_T i = 1; i < tree.size(); i++) {
+        SIZE_T parent = i + (i & -i);
+        if (parent < tree.size()) {
+            tree[parent] += tree[i];
+        }
+    }
+    nextslot = live.size() + 1;
+}
+
+SIZE_T ReuseDistance::Access(const SIZE_T blocknum, const bool read) {
+    SIZE_T distance = REUSE_COLD;
+
+    if (nextslot == tree.size()) {
+        Compact();
+    }
+
+    unordered_map<SIZE_T, Entry>::iterator i = blocks.find(blocknum);
+    if (i != blocks.end()) {
+        Entry &e = (*i).second;
+        // every block whose latest access came later is in between
+        distance = blocks.size() - CountUpTo(e.slot);
+        if (samplerate < 1) {
+            distance = (SIZE_T) (distance / samplerate);
+        }
+        Add(e.slot, -1);
+        e.slot = nextslot;
+        if (e.sincedirty != REUSE_COLD && distance > e.sincedirty) {
+            // Caches of sizes sincedirty+1 through distance evicted it dirty
+            SIZE_T last = distance < MAX_COUNTED_DISTANCE ? distance : MAX_COUNTED_DISTANCE;
+            if (last + 2 > writebacks.size()) {
+                writebacks.resize(last + 2, 0);
+            }
+            writebacks[e.sincedirty + 1]++;
+            writebacks[last + 1]--;
+            // Capped, so the next farther access stays inside writebacks
+            e.sincedirty = last;
+        }
+    } else {
+        Entry e = { nextslot, REUSE_COLD };
+        blocks[blocknum] = e;
+    }
+    Add(nextslot, 1);
+    nextslot++;
+
+    accesses++;
+    if (distance == REUSE_COLD) {
+        cold++;
+        coldreads += read;
+    } else {
+        SIZE_T bucket = 0;
+        while (BucketHigh(bucket) < distance) {
+            bucket++;
+        }
+        if (bucket >= histogram.size()) {
+            histogram.resize(bucket + 1, 0);
+        }
+        histogram[bucket]++;
+        if (!read) {
+            // nothing to read whatever the cache size
+        } else if (distance < MAX_COUNTED_DISTANCE) {
+            if (distance >= reads.size()) {
+                reads.resize(distance + 1, 0);
+            }
+            reads[distance]++;
+        } else {
+            farreads++;
+        }
+    }
+    return distance;
+}
+
+void ReuseDistance::Dirty(const SIZE_T blocknum) {
+    unordered_map<SIZE_T, Entry>::iterator i = blocks.find(blocknum);
+    if (i != blocks.end()) {
+        // dirty in every cache, since it was just accessed
+        (*i).second.sincedirty = 0;
+    }
+}
+
+double ReuseDistance::PredictReads(const SIZE_T cachesize) const {
+    // LRU hits exactly the accesses with distance below its size
+    SIZE_T misses = coldreads + farreads;
+    for (SIZE_T d = cachesize; d < reads.size(); d++) {
+        misses += reads[d];
+    }
+    return misses / samplerate;
+}
+
+double ReuseDistance::PredictWriteBacks(const SIZE_T cachesize) const {
+    long n = 0;
+    for (SIZE_T c = 0; c <= cachesize && c < writebacks.size(); c++) {
+        n += writebacks[c];
+    }
+    return n / samplerate;
+}
+
+ostream &ReuseDistance::Print(ostream &os) const {
+    os << "ReuseDistance(samplerate=" << samplerate << ", accesses=" << accesses << ", cold=" << cold;
+    for (SIZE_T i = 0; i < histogram.size(); i++) {
+        os << ", " << BucketLow(i) << "-" << BucketHigh(i) << "=" << histogram[i];
+    }
+    os << ")";
+    return os;
+}
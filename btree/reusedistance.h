@@ -0,0 +1,107 @@
+#ifndef _reusedistance
+#define _reusedistance
+
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+#include "global.h"
+
+using namespace std;
+
+// Distance of a block's first access
+#define REUSE_COLD ((SIZE_T) -1)
+// Distances counted one by one, beyond any cache we'd size
+const SIZE_T MAX_COUNTED_DISTANCE = 1 << 20;
+
+//
+// Reuse (LRU stack) distance of a stream of block accesses: the number of
+// distinct other blocks touched since the block was last touched.  A cache
+// of n blocks under LRU hits exactly the accesses with distance below n.
+//
+// Each block's latest access is marked in a Fenwick tree indexed by
+// access order, so a distance is a count of the marks after it.  When
+// the tree fills up, the marks are renumbered densely, so memory stays
+// proportional to the number of distinct blocks.
+//
+// Distances are kept in a histogram of power of two buckets: bucket 0
+// holds distance 0 and bucket k holds 2^(k-1) through 2^k - 1.
+//
+// For the miss ratio curve, the distances of accesses that read the
+// block are also counted one by one.  A dirty block is written back when
+// an LRU cache of size n evicts it, which is at the first access after
+// it was dirtied whose distance is at least n.  So each block remembers
+// the largest distance seen since it was last dirtied, and each access
+// adds a write-back to every size between that and its own distance.
+//
+// With a sample rate below 1, only the blocks whose hash falls under the
+// rate are tracked (SHARDS, Waldspurger et al., FAST '15).  A sampled
+// distance d stands for d / rate, and each sampled access for 1 / rate.
+//
+class ReuseDistance {
+private:
+    struct Entry {
+        SIZE_T slot;        // of the block's latest access
+        SIZE_T sincedirty;  // largest distance since dirtied, up to the counted ones, or REUSE_COLD if clean
+    };
+
+    double samplerate;
+    SIZE_T threshold;                           // blocks hashing below this are sampled
+    unordered_map <SIZE_T, Entry> blocks;
+    vector <SIZE_T> tree;                       // Fenwick tree over slots, 1-based
+    SIZE_T nextslot;
+    vector <SIZE_T> histogram;
+    vector <SIZE_T> reads;                      // reading accesses by scaled distance
+    SIZE_T farreads;                            // and those too far to count
+    vector <int> writebacks;                    // write-backs, differences by size
+    SIZE_T accesses, cold, coldreads;
+
+    void Add(SIZE_T slot, const int delta);
+
+    SIZE_T CountUpTo(SIZE_T slot) const;
+
+    void Compact();
+
+public:
+    ReuseDistance(const double samplerate = 1);
+
+    // Whether Access should be called for blocknum at all
+    bool Sampled(const SIZE_T blocknum) const;
+
+    // Records an access to a sampled block, returns its (scaled)
+    // distance or REUSE_COLD.  read is false if the access replaces the
+    // block without looking at it.
+    SIZE_T Access(const SIZE_T blocknum, const bool read = true);
+
+    // The block's latest access changed it
+    void Dirty(const SIZE_T blocknum);
+
+    void Clear();
+
+    double GetSampleRate() const { return samplerate; }
+
+    // Both count sampled accesses only
+    SIZE_T GetNumAccesses() const { return accesses; }
+
+    SIZE_T GetNumColdAccesses() const { return cold; }
+
+    // Buckets past the last nonempty one are left out
+    const vector<SIZE_T> &GetHistogram() const { return histogram; }
+
+    // Smallest and largest distance bucket i holds
+    static SIZE_T BucketLow(const SIZE_T i) { return i == 0 ? 0 : 1U << (i - 1); }
+
+    static SIZE_T BucketHigh(const SIZE_T i) { return i == 0 ? 0 : (1U << (i - 1)) * 2 - 1; }
+
+    // Estimated disk reads and dirty evictions of an LRU cache of
+    // cachesize blocks, over all accesses, sampled or not
+    double PredictReads(const SIZE_T cachesize) const;
+
+    double PredictWriteBacks(const SIZE_T cachesize) const;
+
+    ostream &Print(ostream &os) const;
+};
+
+inline ostream &operator<<(ostream &os, const ReuseDistance &r) { return r.Print(os); }
+
+#endif
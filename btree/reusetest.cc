@@ -0,0 +1,62 @@
+#include <stdlib.h>
+
+#include "reusedistance.h"
+
+// Checks ReuseDistance's write-back counts where distances pass the ones
+// it counts one by one
+
+static int failures = 0;
+
+static void check(const bool ok, const char *what) {
+    if (!ok) {
+        cerr << "FAIL: " << what << endl;
+        failures++;
+    }
+}
+
+// Touches n sampled blocks not touched before, from next on
+static void touch_new(ReuseDistance &r, SIZE_T &next, const SIZE_T n) {
+    for (SIZE_T i = 0; i < n; next++) {
+        if (r.Sampled(next)) {
+            r.Access(next);
+            i++;
+        }
+    }
+}
+
+// A dirty block hit at two growing distances past the cap, at rate
+static void far_dirty(const double rate, const SIZE_T gap) {
+    ReuseDistance r(rate);
+    SIZE_T block = 0, next;
+
+    while (!r.Sampled(block)) {
+        block++;
+    }
+    next = block + 1;
+    r.Access(block, false);
+    r.Dirty(block);
+
+    touch_new(r, next, gap);
+    check(r.Access(block) > MAX_COUNTED_DISTANCE, "first distance past the cap");
+    touch_new(r, next, 2 * gap);
+    check(r.Access(block) > MAX_COUNTED_DISTANCE, "second distance past the cap");
+
+    // Evicted dirty once by any cache it didn't fit, never again
+    check(r.PredictWriteBacks(0) == 0, "no write-back without a cache");
+    check(r.PredictWriteBacks(1) == 1 / r.GetSampleRate(), "one write-back from the smallest cache");
+    check(r.PredictWriteBacks(MAX_COUNTED_DISTANCE) == 1 / r.GetSampleRate(),
+          "one write-back from the largest counted cache");
+}
+
+int main(int argc, char *argv[]) {
+    far_dirty(1, MAX_COUNTED_DISTANCE + 10);
+    // About 1050 sampled blocks stand for more than the cap
+    far_dirty(0.001, 1100);
+
+    if (failures > 0) {
+        cerr << failures << " checks failed\n";
+        exit(-1);
+    }
+    cerr << "All checks passed\n";
+    return 0;
+}
@@ -0,0 +1,148 @@
+#include <string>
+#include <fstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+
+#include "benchutil.h"
+
+
+void usage() {
+    cerr << "usage: scanbench filestem cachesize [-keys n] [-lookups n] [-hot fraction]\n";
+    cerr << "                 [-rounds n] [-ring frames]\n";
+    cerr << "  builds a btree of n keys (default 20000) on filestem, then runs\n";
+    cerr << "  rounds (default 10) of a full sorted Display followed by random\n";
+    cerr << "  LOOKUPs (default 2000) of the lowest fraction (default 0.1) of\n";
+    cerr << "  the keys, once with display reads going through\n";
+    cerr << "  the scan ring (default 16 frames) and once cached like any other read.\n";
+    cerr << "  Reports what the lookups cost in each case.  The tree has to be\n";
+    cerr << "  larger than the cache for there to be a difference.\n";
+}
+
+struct LookupCost {
+    SIZE_T diskreads;
+    SIZE_T hits, misses;
+    double time;
+};
+
+static ERROR_T run(DiskSystem &disk, const SIZE_T cachesize, const SIZE_T ring, const SIZE_T numhot,
+                   const SIZE_T numlookups, const SIZE_T numrounds, LookupCost &cost) {
+    BufferCache cache(&disk, cachesize);
+    BTreeIndex btree(0, 0, &cache);
+    ofstream null("/dev/null");
+    SIZE_T superblocknum;
+    ERROR_T rc;
+    char key[16];
+    VALUE_T val;
+    unsigned seed = 1;
+
+    cache.SetScanRing(ring);
+    if ((rc = cache.Attach()) != ERROR_NOERROR || (rc = btree.Attach(0)) != ERROR_NOERROR) {
+        return rc;
+    }
+
+    cost.diskreads = cost.hits = cost.misses = 0;
+    cost.time = 0;
+    for (SIZE_T r = 0; r <= numrounds; r++) {
+        // Round 0 only warms up the cache
+        if (r > 0 && (rc = btree.Display(null, BTREE_SORTED_KEYVAL)) != ERROR_NOERROR) {
+            return rc;
+        }
+        SIZE_T diskreads = cache.GetNumDiskReads();
+        SIZE_T hits = cache.GetNumHits(), misses = cache.GetNumMisses();
+        double start = cache.GetCurrentTime();
+        for (SIZE_T i = 0; i < numlookups; i++) {
+            make_key(key, rand_r(&seed) % numhot);
+            rc = btree.Lookup(KEY_T(key), val);
+            if (rc != ERROR_NOERROR && rc != ERROR_NONEXISTENT) {
+                return rc;
+            }
+        }
+        if (r > 0) {
+            cost.diskreads += cache.GetNumDiskReads() - diskreads;
+            cost.hits += cache.GetNumHits() - hits;
+            cost.misses += cache.GetNumMisses() - misses;
+            cost.time += cache.GetCurrentTime() - start;
+        }
+    }
+
+    if ((rc = btree.Detach(superblocknum)) != ERROR_NOERROR) {
+        return rc;
+    }
+    return cache.Detach();
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage();
+        exit(-1);
+    }
+    SIZE_T cachesize = atoi(argv[2]);
+    SIZE_T numkeys = 20000;
+    SIZE_T numlookups = 2000;
+    SIZE_T numrounds = 10;
+    double hot = 0.1;
+    SIZE_T ring = 16;
+
+    for (int i = 3; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "-keys" && i + 1 < argc) {
+            numkeys = atoi(argv[++i]);
+        } else if (opt == "-lookups" && i + 1 < argc) {
+            numlookups = atoi(argv[++i]);
+        } else if (opt == "-hot" && i + 1 < argc) {
+            hot = atof(argv[++i]);
+        } else if (opt == "-rounds" && i + 1 < argc) {
+            numrounds = atoi(argv[++i]);
+        } else if (opt == "-ring" && i + 1 < argc) {
+            ring = atoi(argv[++i]);
+        } else {
+            usage();
+            exit(-1);
+        }
+    }
+    SIZE_T numhot = (SIZE_T) (hot * numkeys);
+    if (numhot < 1 || numhot > numkeys || ring < 1) {
+        usage();
+        exit(-1);
+    }
+
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(argv[1]));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
+    ERROR_T rc;
+
+    if ((rc = build_tree(disk, cachesize, numkeys)) != ERROR_NOERROR) {
+        cerr << "Can't build the btree due to error " << rc << endl;
+        return -1;
+    }
+
+    // With the whole tree cached, neither run reads the disk and the
+    // comparison says nothing
+    SIZE_T numfree, numextents, largest;
+    disk.GetFreeSpaceSummary(numfree, numextents, largest);
+    SIZE_T treeblocks = disk.GetNumBlocks() - numfree;
+    if (treeblocks <= cachesize) {
+        cerr << "The tree's " << treeblocks << " blocks fit in a cache of " << cachesize
+             << "; use more -keys or a smaller cache\n";
+        return -1;
+    }
+
+    LookupCost withring, without;
+    if ((rc = run(disk, cachesize, ring, numhot, numlookups, numrounds, withring)) != ERROR_NOERROR
+        || (rc = run(disk, cachesize, 0, numhot, numlookups, numrounds, without)) != ERROR_NOERROR) {
+        cerr << "Run failed due to error " << rc << endl;
+        return -1;
+    }
+
+    cerr << "display\tlookup diskreads\tlookup hitratio\tlookup time\n";
+    cerr << "ring " << ring << "\t" << withring.diskreads << "\t"
+         << (double) withring.hits / (withring.hits + withring.misses) << "\t" << withring.time << endl;
+    cerr << "no ring\t" << without.diskreads << "\t"
+         << (double) without.hits / (without.hits + without.misses) << "\t" << without.time << endl;
+
+    return 0;
+}
@@ -0,0 +1,30 @@
+#!/usr/bin/perl -w
+
+# Replays the same sim request file under each disk scheduler and prints
+# simulated disk throughput, read and write latency percentiles, and
+# simulated time side by side.  Options after the request file go to sim;
+# the schedulers only have queues to reorder with -dirty or -readahead.
+
+$#ARGV >= 2 or die "usage: schedulers.pl filestem cachesize simrequests [sim options]\n";
+
+($filestem, $cachesize, $requests, @options) = @ARGV;
+
+$ENV{PATH} .= ":.";
+
+printf "%-9s %10s %10s %10s %10s %10s %12s\n", "scheduler", "reqs/s", "read p50", "read p99",
+    "write p50", "write p99", "time";
+
+foreach $sched ("fifo", "sstf", "scan", "clook", "deadline") {
+    my %stat;
+    open(SIM, "sim $filestem $cachesize -sched $sched @options < $requests 2>&1 >/dev/null |")
+        or die "can't run sim\n";
+    while (<SIM>) {
+        if (/^(\w[\w ]*?)\s*=\s*(\S+)/) {
+            $stat{$1} = $2;
+        }
+    }
+    close(SIM);
+    printf "%-9s %10.1f %10.3f %10.3f %10.3f %10.3f %12.2f\n", $sched, $stat{"diskthroughput"},
+        $stat{"readlat p50"}, $stat{"readlat p99"}, $stat{"writelat p50"}, $stat{"writelat p99"},
+        $stat{"total time"};
+}
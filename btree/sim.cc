@@ -4,13 +4,15 @@
 #include <string>
 #include <strstream>
 #include <fstream>
+#include <memory>
 #include "btree.h"
+#include "toolutil.h"
 
 
 using namespace std;
 
 void usage() {
-    cerr << "usage: sim filestem cachesize < specfile \n";
+    cerr << "usage: sim filestem cachesize [-budget bytes] [-policy lru|clock|2q|arc|lru2] [-sched fifo|sstf|scan|clook|deadline] [-shards n] [-dirty fraction] [-coalesce] [-readahead n] [-retain frames] [-noelide] [-backend stdio|mmap|pread|direct] [-mrc samplerate] [--stats-json file] < specfile \n";
 }
 
 
@@ -18,7 +20,7 @@ int main(int argc, char *argv[]) {
 
     // CONFORMS to the interface of ref_impl.pl
 
-    if (argc != 3) {
+    if (argc < 3) {
         usage();
         return 1;
     }
@@ -26,6 +28,59 @@ int main(int argc, char *argv[]) {
     char *filestem = argv[1];
     SIZE_T cachesize = atoi(argv[2]);
     SIZE_T superblocknum;
+    ReplacementPolicyType policy = REPLACEMENT_LRU;
+    DiskSchedulerType sched = DISKSCHED_CLOOK;
+    SIZE_T numshards = 1;
+    double dirtythreshold = 0;
+    bool coalesce = false;
+    SIZE_T readahead = 0;
+    bool elide = true;
+    DiskBackend backend = DISK_STDIO;
+    SIZE_T retain = 0;
+    size_t budget = 0;
+    char *statsjson = 0;
+    double mrcrate = 0;
+
+    for (int i = 3; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "-budget" && i + 1 < argc) {
+            budget = strtoul(argv[++i], 0, 10);
+        } else if (opt == "-policy" && i + 1 < argc) {
+            if (ReplacementPolicy::ParseType(argv[++i], policy) != ERROR_NOERROR) {
+                usage();
+                return 1;
+            }
+        } else if (opt == "-sched" && i + 1 < argc) {
+            if (DiskScheduler::ParseType(argv[++i], sched) != ERROR_NOERROR) {
+                usage();
+                return 1;
+            }
+        } else if (opt == "-shards" && i + 1 < argc) {
+            numshards = atoi(argv[++i]);
+        } else if (opt == "-dirty" && i + 1 < argc) {
+            dirtythreshold = atof(argv[++i]);
+        } else if (opt == "-coalesce") {
+            coalesce = true;
+        } else if (opt == "-readahead" && i + 1 < argc) {
+            readahead = atoi(argv[++i]);
+        } else if (opt == "-retain" && i + 1 < argc) {
+            retain = atoi(argv[++i]);
+        } else if (opt == "-noelide") {
+            elide = false;
+        } else if (opt == "-backend" && i + 1 < argc) {
+            if (DiskSystem::ParseBackend(argv[++i], backend) != ERROR_NOERROR) {
+                usage();
+                return 1;
+            }
+        } else if (opt == "-mrc" && i + 1 < argc) {
+            mrcrate = atof(argv[++i]);
+        } else if (opt == "--stats-json" && i + 1 < argc) {
+            statsjson = argv[++i];
+        } else {
+            usage();
+            return 1;
+        }
+    }
 
     FILE *file;
     char line[1024];
@@ -35,8 +90,29 @@ int main(int argc, char *argv[]) {
     // We'll connect to the btree only once and then
     // run lots of operations
     // so we need to do this outside the loop
-    DiskSystem disk(filestem);
-    BufferCache cache(&disk, cachesize);
+    // A striped array if filestem is one
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(filestem));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
+    if ((rc = disk.SetBackend(backend)) != ERROR_NOERROR) {
+        cerr << "Can't set up the disk backend due to error " << rc << "\n";
+        return -1;
+    }
+    if (budget > 0) {
+        // overrides the block count
+        cachesize = BufferCache::GetFramesForBudget(budget, disk.GetBlockSize());
+    }
+    BufferCache cache(&disk, cachesize, policy, false, numshards);
+    cache.SetScheduler(sched);
+    cache.SetDirtyThreshold(dirtythreshold);
+    cache.SetCoalesceEvictions(coalesce);
+    cache.SetReadahead(readahead);
+    cache.SetElideWrites(elide);
+    cache.SetRetention(retain);
+    cache.SetTrackReuse(statsjson != 0 || mrcrate > 0, mrcrate > 0 ? mrcrate : 1);
     // will be set on init
     BTreeIndex *btree;
 
@@ -102,6 +178,14 @@ int main(int argc, char *argv[]) {
             cout << "OK BEGIN DISPLAY\n";
             btree->Display(cout, BTREE_SORTED_KEYVAL);
             cout << "OK END DISPLAY\n";
+        } else if (action == "RESIZE") {
+            // not in ref_impl.pl: changes the cache's budget to key bytes
+            if ((rc = cache.Resize(strtoul(key.c_str(), 0, 10))) != ERROR_NOERROR) {
+                cout << "FAIL" << endl;
+                cerr << "Can't resize cache due to error " << rc << endl;
+            } else {
+                cout << "OK\n";
+            }
         } else if (action == "DEINIT") {
             if ((rc = btree->Detach(superblocknum)) != ERROR_NOERROR) {
                 cout << "FAIL" << endl;
@@ -120,6 +204,38 @@ int main(int argc, char *argv[]) {
 
     fclose(file);
 
+    cerr << "policy          = " << cache.GetPolicyName() << endl;
+    cerr << "scheduler       = " << cache.GetSchedulerName() << endl;
+    cerr << "cachesize       = " << cache.GetCacheSize() << endl;
+    cerr << "memorybytes     = " << cache.GetMemoryBytes() << endl;
+    cerr << "numreads        = " << cache.GetNumReads() << endl;
+    cerr << "numdiskreads    = " << cache.GetNumDiskReads() << endl;
+    cerr << "numdiskreadreqs = " << cache.GetNumDiskReadRequests() << endl;
+    cerr << "readaheads      = " << cache.GetNumReadaheads() << endl;
+    cerr << "readaheadhits   = " << cache.GetNumReadaheadHits() << endl;
+    cerr << "numwrites       = " << cache.GetNumWrites() << endl;
+    cerr << "elidedwrites    = " << cache.GetNumElidedWrites() << endl;
+    cerr << "numdiskwrites   = " << cache.GetNumDiskWrites() << endl;
+    cerr << "numdiskwritereqs= " << cache.GetNumDiskWriteRequests() << endl;
+    cerr << "evictionwrites  = " << cache.GetNumEvictionWrites() << endl;
+    cerr << "backgroundwrites= " << cache.GetNumBackgroundWrites() << endl;
+    cerr << "hitratio        = " << cache.GetHitRatio() << endl;
+    cerr << "diskthroughput  = " << cache.GetDiskThroughput() << endl;
+    cerr << "readlat p50     = " << cache.GetReadLatency().GetPercentile(0.5) << endl;
+    cerr << "readlat p99     = " << cache.GetReadLatency().GetPercentile(0.99) << endl;
+    cerr << "writelat p50    = " << cache.GetWriteLatency().GetPercentile(0.5) << endl;
+    cerr << "writelat p99    = " << cache.GetWriteLatency().GetPercentile(0.99) << endl;
+    cerr << "total time      = " << cache.GetCurrentTime() << endl;
+
+    if (mrcrate > 0) {
+        cerr << endl;
+        cache.PrintSizeAdvice(cerr);
+    }
+
+    if (write_stats_json(cache, statsjson) != ERROR_NOERROR) {
+        return -1;
+    }
+
     return 0;
 
 }
@@ -0,0 +1,29 @@
+#include <fstream>
+#include <string>
+
+#include "toolutil.h"
+
+
+char *take_stats_json(int &argc, char **argv) {
+    if (argc > 2 && string(argv[argc - 2]) == "--stats-json") {
+        argc -= 2;
+        return argv[argc + 1];
+    }
+    return 0;
+}
+
+ERROR_T write_stats_json(const BufferCache &cache, const char *file) {
+    if (!file) {
+        return ERROR_NOERROR;
+    }
+    ofstream out(file);
+    if (out) {
+        cache.PrintJSON(out);
+        out.close();
+    }
+    if (!out) {
+        cerr << "Can't write the statistics to " << file << endl;
+        return ERROR_NOFILE;
+    }
+    return ERROR_NOERROR;
+}
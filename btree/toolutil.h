@@ -0,0 +1,18 @@
+#ifndef _toolutil
+#define _toolutil
+
+#include "buffercache.h"
+
+//
+// What the btree_* tools and sim share on the command line
+//
+
+// The file of a trailing --stats-json file, which comes off argc; null
+// if there is none
+char *take_stats_json(int &argc, char **argv);
+
+// Writes the cache's statistics to file as JSON, if file is set
+// returns ERROR_NOERROR, or ERROR_NOFILE after saying so on cerr
+ERROR_T write_stats_json(const BufferCache &cache, const char *file);
+
+#endif
@@ -0,0 +1,145 @@
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <memory>
+
+#include "benchutil.h"
+
+
+void usage() {
+    cerr << "usage: warmbench filestem cachesize [-keys n] [-lookups n] [-window n]\n";
+    cerr << "  builds a btree of n keys (default 20000) on filestem and runs a\n";
+    cerr << "  session of random LOOKUPs (default 4000) so that its Detach leaves a\n";
+    cerr << "  warm-up list behind.  Then runs the same new session twice, once\n";
+    cerr << "  warming up from the list at Attach and once starting cold, and\n";
+    cerr << "  reports how long each takes to reach the cold session's final hit\n";
+    cerr << "  ratio, measured over windows of n lookups (default 100).\n";
+}
+
+struct SessionCost {
+    SIZE_T warmupblocks;
+    double warmuptime;
+    vector<double> hitratios;   // of each window
+    vector<double> times;       // at the end of each window, from before Attach
+    double time;
+};
+
+static ERROR_T session(DiskSystem &disk, const SIZE_T cachesize, const bool warmup, const SIZE_T numkeys,
+                       const SIZE_T numlookups, const SIZE_T window, unsigned seed, SessionCost &cost) {
+    BufferCache cache(&disk, cachesize);
+    BTreeIndex btree(0, 0, &cache);
+    SIZE_T superblocknum;
+    ERROR_T rc;
+    char key[16];
+    VALUE_T val;
+
+    cache.SetWarmup(warmup);
+    if ((rc = cache.Attach()) != ERROR_NOERROR || (rc = btree.Attach(0)) != ERROR_NOERROR) {
+        return rc;
+    }
+    cost.warmupblocks = cache.GetNumWarmupBlocks();
+    cost.warmuptime = cache.GetWarmupTime();
+
+    cost.hitratios.clear();
+    cost.times.clear();
+    SIZE_T hits = cache.GetNumHits(), misses = cache.GetNumMisses();
+    for (SIZE_T i = 1; i <= numlookups; i++) {
+        make_key(key, rand_r(&seed) % numkeys);
+        rc = btree.Lookup(KEY_T(key), val);
+        if (rc != ERROR_NOERROR && rc != ERROR_NONEXISTENT) {
+            return rc;
+        }
+        if (i % window == 0) {
+            SIZE_T h = cache.GetNumHits() - hits, m = cache.GetNumMisses() - misses;
+            cost.hitratios.push_back(h + m > 0 ? (double) h / (h + m) : 1);
+            cost.times.push_back(cache.GetCurrentTime());
+            hits += h;
+            misses += m;
+        }
+    }
+    cost.time = cache.GetCurrentTime();
+
+    if ((rc = btree.Detach(superblocknum)) != ERROR_NOERROR) {
+        return rc;
+    }
+    return cache.Detach();
+}
+
+// First window at which the hit ratio gets within 0.02 of steady
+static SIZE_T steady_window(const SessionCost &cost, const double steady) {
+    for (SIZE_T w = 0; w < cost.hitratios.size(); w++) {
+        if (cost.hitratios[w] >= steady - 0.02) {
+            return w;
+        }
+    }
+    return cost.hitratios.size() - 1;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        usage();
+        exit(-1);
+    }
+    SIZE_T cachesize = atoi(argv[2]);
+    SIZE_T numkeys = 20000;
+    SIZE_T numlookups = 4000;
+    SIZE_T window = 100;
+
+    for (int i = 3; i < argc; i++) {
+        string opt = argv[i];
+        if (opt == "-keys" && i + 1 < argc) {
+            numkeys = atoi(argv[++i]);
+        } else if (opt == "-lookups" && i + 1 < argc) {
+            numlookups = atoi(argv[++i]);
+        } else if (opt == "-window" && i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else {
+            usage();
+            exit(-1);
+        }
+    }
+    if (numkeys < 1 || window < 1 || numlookups < 2 * window) {
+        usage();
+        exit(-1);
+    }
+
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(argv[1]));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
+    ERROR_T rc;
+
+    if ((rc = build_tree(disk, cachesize, numkeys)) != ERROR_NOERROR) {
+        cerr << "Can't build the btree due to error " << rc << endl;
+        return -1;
+    }
+
+    // The warm session has to go first, since every Detach saves a new list
+    SessionCost previous, warm, cold;
+    if ((rc = session(disk, cachesize, false, numkeys, numlookups, window, 1, previous)) != ERROR_NOERROR
+        || (rc = session(disk, cachesize, true, numkeys, numlookups, window, 2, warm)) != ERROR_NOERROR
+        || (rc = session(disk, cachesize, false, numkeys, numlookups, window, 2, cold)) != ERROR_NOERROR) {
+        cerr << "Session failed due to error " << rc << endl;
+        return -1;
+    }
+
+    // What the cold session settles to, over its second half
+    double steady = 0;
+    SIZE_T half = cold.hitratios.size() / 2;
+    for (SIZE_T w = half; w < cold.hitratios.size(); w++) {
+        steady += cold.hitratios[w];
+    }
+    steady /= cold.hitratios.size() - half;
+
+    SIZE_T warmsteady = steady_window(warm, steady), coldsteady = steady_window(cold, steady);
+    cerr << "steady hitratio = " << steady << endl;
+    cerr << "session\twarmup blocks\twarmup time\tlookups to steady\ttime to steady\ttotal time\n";
+    cerr << "warm\t" << warm.warmupblocks << "\t" << warm.warmuptime << "\t"
+         << (warmsteady + 1) * window << "\t" << warm.times[warmsteady] << "\t" << warm.time << endl;
+    cerr << "cold\t" << cold.warmupblocks << "\t" << cold.warmuptime << "\t"
+         << (coldsteady + 1) * window << "\t" << cold.times[coldsteady] << "\t" << cold.time << endl;
+
+    return 0;
+}
@@ -1,5 +1,6 @@
 #include <string>
 #include <stdlib.h>
+#include <memory>
 
 #include "buffercache.h"
 
@@ -17,7 +18,12 @@ int main(int argc, char *argv[]) {
     SIZE_T blocknum = atoi(argv[3]);
     SIZE_T numblocks = atoi(argv[4]);
 
-    DiskSystem disk(argv[1]);
+    unique_ptr<DiskSystem> diskp(DiskSystem::Open(argv[1]));
+    if (!diskp) {
+        cerr << "Can't open the disk\n";
+        return -1;
+    }
+    DiskSystem &disk = *diskp;
     BufferCache cache(&disk, cachesize);
 
     SIZE_T blocksize = disk.GetBlockSize();